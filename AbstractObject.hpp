@@ -5,15 +5,35 @@
 #ifndef GPGPU_HF_ABSTRACTOBJECT_H
 #define GPGPU_HF_ABSTRACTOBJECT_H
 
+#include <cstddef>
+#include <vector>
+
+#include <CL/cl_platform.h>
+
+// Integrator.hpp
+enum class Integrator;
 
 class AbstractObject {
 public:
     virtual void step(float dt) = 0;
     virtual void render() = 0;
 
+    // called once per frame after stepping, before render(); enqueues copying
+    // what render() draws back to the host
+    virtual void endFrame() {};
+
+    virtual size_t vertexCount() const = 0;
+
+    // current positions, in the order of the points in the source file
+    virtual void readPositions(std::vector<cl_float4> &positions) = 0;
+
     //these only make sense for volume objects
     virtual void inflate(float dt) {};
     virtual void deflate(float dt) {};
+    virtual void setFused(bool /*fused*/) {};
+    virtual void setCollisions(bool /*collisions*/) {};
+
+    virtual void setIntegrator(Integrator /*integrator*/) {};
 
     virtual ~AbstractObject() {};
 };
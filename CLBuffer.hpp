@@ -3,9 +3,12 @@
 
 #include <CL/cl.h>
 #include "clwrapper.hpp"
+#include "Profiler.hpp"
 
 #include <cstdio>
 #include <cstring>
+#include <utility>
+#include <vector>
 
 template<typename T>
 class CLBuffer {
@@ -15,31 +18,68 @@ class CLBuffer {
     size_t length;
     int mapcount = 0;
 
+    // empty buffers still get one element, OpenCL refuses zero sized ones
+    size_t bytes() const {
+        return (length ? length : 1) * sizeof(T);
+    }
+
 public:
 
     CLBuffer(size_t length) : length{length} {
         mem = clCreateBuffer(CLWrapper::instance->context(), CL_MEM_READ_WRITE,
-                             length * sizeof(T), NULL, NULL);
+                             bytes(), NULL, NULL);
 
         map();
 
-        memset(mapped, 0, length * sizeof(T));
+        memset(mapped, 0, bytes());
 
         unmap();
     }
 
+    // copies length elements from host memory (e.g. a mapped file) straight into the new buffer
+    CLBuffer(const T *data, size_t length) : length{length} {
+        if (!length) {
+            mem = clCreateBuffer(CLWrapper::instance->context(), CL_MEM_READ_WRITE,
+                                 bytes(), NULL, NULL);
+            return;
+        }
+
+        mem = clCreateBuffer(CLWrapper::instance->context(), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                             bytes(), (void *) data, NULL);
+    }
+
+    CLBuffer(const std::vector<T> &data) : CLBuffer(data.data(), data.size()) {}
+
+    size_t size() const {
+        return length;
+    }
+
     T *map() {
         ++mapcount;
         //std::cout << "mapping, count = " << mapcount << std::endl;
 
         if (!mapped) {
+            // the host span covers the stall until queued kernels are done
+            ProfileScope scope("map");
+            Profiler *profiler = Profiler::instance;
+            uint64_t hostEnqueue = profiler ? profiler->now() : 0;
+
+            // the map has to see the results of every kernel enqueued so far
+            if (CLWrapper::instance->outOfOrder()) {
+                CLWrapper::instance->enqueueBarrier();
+            }
+
             cl_event ev;
             mapped = (T *) clEnqueueMapBuffer(CLWrapper::instance->cqueue(),
                                               mem, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0,
-                                              length * sizeof(T),
+                                              bytes(),
                                               0, NULL, &ev, NULL);
             clWaitForEvents(1, &ev);
-            clReleaseEvent(ev);
+            if (profiler) {
+                profiler->record("map", ev, hostEnqueue);
+            } else {
+                clReleaseEvent(ev);
+            }
         } else {
             std::cerr << "MAPPING AGAIN!" << std::endl;
         }
@@ -47,14 +87,33 @@ public:
         return mapped;
     }
 
+    // the host does not wait for the unmap to finish: later kernels see the
+    // written data because the queue orders them after it, on an in-order
+    // queue by itself and on an out-of-order one through the barrier below
     void unmap() {
         --mapcount;
         //std::cout << "unmapping, count = " << mapcount << std::endl;
-        cl_event ev;
         if (mapped) {
-            clEnqueueUnmapMemObject(CLWrapper::instance->cqueue(), mem, mapped, 0, NULL, &ev);
-            clWaitForEvents(1, &ev);
-            clReleaseEvent(ev);
+            Profiler *profiler = Profiler::instance;
+            uint64_t hostEnqueue = profiler ? profiler->now() : 0;
+            bool blocking = CLWrapper::instance->blockingLaunches();
+
+            cl_event ev = 0;
+            clEnqueueUnmapMemObject(CLWrapper::instance->cqueue(), mem, mapped, 0, NULL,
+                                    blocking || profiler ? &ev : NULL);
+            if (ev && blocking) {
+                clWaitForEvents(1, &ev);
+            }
+            if (ev && profiler) {
+                profiler->record("unmap", ev, hostEnqueue);
+            } else if (ev) {
+                clReleaseEvent(ev);
+            }
+
+            // and later kernels have to see what the host wrote
+            if (CLWrapper::instance->outOfOrder()) {
+                CLWrapper::instance->enqueueBarrier();
+            }
         }
         mapped = 0;
     }
@@ -63,6 +122,12 @@ public:
         return mem;
     }
 
+    // exchanges the device memory of two unmapped buffers of the same length
+    void swap(CLBuffer &other) {
+        std::swap(mem, other.mem);
+        std::swap(length, other.length);
+    }
+
     ~CLBuffer() {
         //std::cout << "mapcount = " << mapcount << std::endl;
         if (mapped) {
@@ -6,6 +6,41 @@
 #define GPGPU_HF_CLKERNEL_H
 
 #include "clwrapper.hpp"
+#include "Profiler.hpp"
+
+// Orders the commands of one object on an out-of-order queue: each launch
+// through it waits for the previous one. Independent objects use separate
+// chains and may run concurrently. On an in-order queue it is not used.
+class EventChain {
+    cl_event last = 0;
+
+public:
+    EventChain() {}
+
+    EventChain(const EventChain &) = delete;
+    EventChain &operator=(const EventChain &) = delete;
+
+    ~EventChain() {
+        reset();
+    }
+
+    cl_uint count() const { return last ? 1 : 0; }
+
+    const cl_event *events() const { return last ? &last : NULL; }
+
+    // ev becomes the event the next command waits for; takes over its reference
+    void advance(cl_event ev) {
+        reset();
+        last = ev;
+    }
+
+    void reset() {
+        if (last) {
+            clReleaseEvent(last);
+            last = 0;
+        }
+    }
+};
 
 template<typename... paramTypes>
 class CLKernel {
@@ -24,27 +59,78 @@ class CLKernel {
     }
 
     std::string name;
+    size_t localSize;
 public:
 
-    CLKernel(const char *name) : name{name} {
+    // a nonzero localSize fixes the work-group size (for kernels using local
+    // memory); the global size is then rounded up to a multiple of it
+    CLKernel(const char *name, size_t localSize = 0) : name{name}, localSize{localSize} {
         kernel = CLWrapper::instance->createKernel(CLWrapper::instance->program(), name);
     }
 
 
-    void execute(size_t size, paramTypes... params) {
-        //std::cout << "executing " << name << std::endl;
-        cl_event ev;
+    // enqueues the kernel after the given events and returns immediately;
+    // if ev is not NULL it receives the launch event, which the caller releases
+    void enqueue(size_t size, cl_uint numWaitEvents, const cl_event *waitEvents, cl_event *ev,
+                 paramTypes... params) {
+        //std::cout << "enqueueing " << name << std::endl;
         setParam(0, params...);
-        int result = clEnqueueNDRangeKernel(CLWrapper::instance->cqueue(), kernel, 1, NULL, &size, NULL, 0, NULL, &ev);
+        if (localSize) {
+            size = (size + localSize - 1) / localSize * localSize;
+        }
+
+        // when profiling, every launch gets an event, even if the caller needs none
+        Profiler *profiler = Profiler::instance;
+        cl_event profiled = 0;
+        uint64_t hostEnqueue = profiler ? profiler->now() : 0;
+        int result = clEnqueueNDRangeKernel(CLWrapper::instance->cqueue(), kernel, 1, NULL, &size,
+                                            localSize ? &localSize : NULL,
+                                            numWaitEvents, waitEvents,
+                                            ev ? ev : (profiler ? &profiled : NULL));
 
         if(result != CL_SUCCESS)
-            std::cerr << CLWrapper::getErrorString(result) << std::endl;
-        else {
+            std::cerr << name << ": " << CLWrapper::getErrorString(result) << std::endl;
+        else if (profiler) {
+            if (ev) {
+                clRetainEvent(*ev);
+                profiled = *ev;
+            }
+            profiler->record(name.c_str(), profiled, hostEnqueue);
+        }
+    }
+
+    // in-order launch; only waits for completion in blocking mode
+    void execute(size_t size, paramTypes... params) {
+        //std::cout << "executing " << name << std::endl;
+        if (!CLWrapper::instance->blockingLaunches()) {
+            enqueue(size, 0, NULL, NULL, params...);
+            return;
+        }
+
+        cl_event ev = 0;
+        enqueue(size, 0, NULL, &ev, params...);
+        if (ev) {
             clWaitForEvents(1, &ev);
             clReleaseEvent(ev);
         }
     }
 
+    // like execute(), but on an out-of-order queue the launch waits for the
+    // previous command of the chain instead of everything enqueued before
+    void execute(EventChain &chain, size_t size, paramTypes... params) {
+        if (!CLWrapper::instance->outOfOrder()) {
+            execute(size, params...);
+            return;
+        }
+
+        cl_event ev = 0;
+        enqueue(size, chain.count(), chain.events(), &ev, params...);
+        if (ev && CLWrapper::instance->blockingLaunches()) {
+            clWaitForEvents(1, &ev);
+        }
+        chain.advance(ev);
+    }
+
     ~CLKernel() {
         clReleaseKernel(kernel);
     }
@@ -0,0 +1,81 @@
+#include "CollisionGrid.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+static float distance(const cl_float4 &a, const cl_float4 &b) {
+    float x = a.s[0] - b.s[0], y = a.s[1] - b.s[1], z = a.s[2] - b.s[2];
+    return std::sqrt(x * x + y * y + z * z);
+}
+
+CollisionGrid::CollisionGrid():
+        clearCellsKernel{"clearCells"},
+        countFacesKernel{"countFaces"},
+        scanCountsKernel{"scanCounts", reduceGroupSize},
+        scanGroupSumsKernel{"scanGroupSums", reduceGroupSize},
+        addGroupSumsKernel{"addGroupSums", reduceGroupSize},
+        scatterFacesKernel{"scatterFaces"},
+        collideKernel{"collidePoints"}
+{
+}
+
+void CollisionGrid::setFaces(const std::vector<cl_float4> &positions, const std::vector<cl_int4> &faces) {
+    faceCount = faces.size();
+
+    double edgeSum = 0;
+    float reach = 0;
+    for (const auto &f : faces) {
+        const cl_float4 &a = positions[f.s[0]];
+        const cl_float4 &b = positions[f.s[1]];
+        const cl_float4 &c = positions[f.s[2]];
+
+        edgeSum += distance(a, b) + distance(b, c) + distance(c, a);
+
+        cl_float4 centroid = {{(a.s[0] + b.s[0] + c.s[0]) / 3,
+                               (a.s[1] + b.s[1] + c.s[1]) / 3,
+                               (a.s[2] + b.s[2] + c.s[2]) / 3, 0}};
+        reach = std::max({reach, distance(centroid, a), distance(centroid, b), distance(centroid, c)});
+    }
+
+    thickness = faceCount ? (float) (edgeSum / (3 * faceCount)) / 4 : 0;
+    cellSize = std::max(1.5f * reach + thickness, 1e-3f);
+
+    // about two entries per face keeps the hash collisions rare
+    tableSize = reduceGroupSize;
+    while (tableSize < 2 * faceCount) {
+        tableSize *= 2;
+    }
+
+    faceCellBuffer.reset(new CLBuffer<cl_uint>(faceCount));
+    faceRankBuffer.reset(new CLBuffer<cl_int>(faceCount));
+    cellCountBuffer.reset(new CLBuffer<cl_int>(tableSize));
+    cellStartBuffer.reset(new CLBuffer<cl_int>(tableSize));
+    groupSumBuffer.reset(new CLBuffer<cl_int>(tableSize / reduceGroupSize));
+    sortedFaceBuffer.reset(new CLBuffer<cl_int4>(faceCount));
+}
+
+void CollisionGrid::collide(EventChain &chain, size_t n,
+                            CLBuffer<cl_float4> &position, CLBuffer<cl_float4> &velocity, CLBuffer<cl_float4> &nextPosition,
+                            CLBuffer<cl_int4> &faces, CLBuffer<cl_int> &objects,
+                            CLBuffer<cl_int> &pairOffsets, CLBuffer<cl_int> &pairs) {
+    if (!n || !faceCount) {
+        return;
+    }
+
+    cl_uint tableMask = (cl_uint) tableSize - 1;
+    size_t groups = tableSize / reduceGroupSize;
+
+    clearCellsKernel.execute(chain, tableSize, *cellCountBuffer);
+    countFacesKernel.execute(chain, faceCount, cellSize, tableMask, position, faces,
+                             *faceCellBuffer, *faceRankBuffer, *cellCountBuffer);
+
+    scanCountsKernel.execute(chain, tableSize, *cellCountBuffer, *cellStartBuffer, *groupSumBuffer);
+    scanGroupSumsKernel.execute(chain, reduceGroupSize, (int) groups, *groupSumBuffer);
+    addGroupSumsKernel.execute(chain, tableSize, *groupSumBuffer, *cellStartBuffer);
+
+    scatterFacesKernel.execute(chain, faceCount, faces, *faceCellBuffer, *faceRankBuffer,
+                               *cellStartBuffer, *sortedFaceBuffer);
+
+    collideKernel.execute(chain, n, cellSize, tableMask, thickness, position, velocity, objects,
+                          pairOffsets, pairs, *cellStartBuffer, *cellCountBuffer, *sortedFaceBuffer, nextPosition);
+}
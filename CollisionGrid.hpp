@@ -0,0 +1,63 @@
+#ifndef GPGPU_HF_COLLISIONGRID_H
+#define GPGPU_HF_COLLISIONGRID_H
+
+#include <memory>
+#include <vector>
+
+#include <CL/cl_platform.h>
+
+#include "CLBuffer.hpp"
+#include "CLKernel.hpp"
+
+// Point against face contacts between and within closed meshes packed into
+// one set of buffers, as in VolumeWorld. The broad phase is a uniform grid
+// rebuilt on the device every substep: the faces are hashed by centroid and
+// counting sorted by cell, so a point only tests the faces near it (see the
+// comment above cellHash in programs.cl).
+class CollisionGrid {
+    size_t faceCount = 0;
+
+    // hash table entries, a power of two and a multiple of reduceGroupSize
+    size_t tableSize = 0;
+
+    // REDUCE_GROUP_SIZE in programs.cl
+    size_t reduceGroupSize = 128;
+
+    float cellSize = 1;
+
+    std::unique_ptr<CLBuffer<cl_uint>> faceCellBuffer;
+    std::unique_ptr<CLBuffer<cl_int>> faceRankBuffer;
+    std::unique_ptr<CLBuffer<cl_int>> cellCountBuffer;
+    std::unique_ptr<CLBuffer<cl_int>> cellStartBuffer;
+    std::unique_ptr<CLBuffer<cl_int>> groupSumBuffer;
+    std::unique_ptr<CLBuffer<cl_int4>> sortedFaceBuffer;
+
+    CLKernel<cl_mem> clearCellsKernel;
+    CLKernel<float, cl_uint, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem> countFacesKernel;
+    CLKernel<cl_mem, cl_mem, cl_mem> scanCountsKernel;
+    CLKernel<int, cl_mem> scanGroupSumsKernel;
+    CLKernel<cl_mem, cl_mem> addGroupSumsKernel;
+    CLKernel<cl_mem, cl_mem, cl_mem, cl_mem, cl_mem> scatterFacesKernel;
+    CLKernel<float, cl_uint, float, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem> collideKernel;
+
+public:
+    // points closer to a face than this are pushed out, set by setFaces()
+    float thickness = 0;
+
+    CollisionGrid();
+
+    // sizes the grid for the faces at the given positions: the thickness is a
+    // quarter of the mean edge length, the cells hold the largest face even
+    // stretched to 1.5 times its size
+    void setFaces(const std::vector<cl_float4> &positions, const std::vector<cl_int4> &faces);
+
+    // enqueues resolving the contacts of the n points at position into
+    // nextPosition; the velocities towards the faces are removed in place
+    void collide(EventChain &chain, size_t n,
+                 CLBuffer<cl_float4> &position, CLBuffer<cl_float4> &velocity, CLBuffer<cl_float4> &nextPosition,
+                 CLBuffer<cl_int4> &faces, CLBuffer<cl_int> &objects,
+                 CLBuffer<cl_int> &pairOffsets, CLBuffer<cl_int> &pairs);
+};
+
+
+#endif //GPGPU_HF_COLLISIONGRID_H
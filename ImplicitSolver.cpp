@@ -0,0 +1,66 @@
+#include "ImplicitSolver.hpp"
+
+// slots of scalarBuffer, CG_* in programs.cl
+static const int rzSlots[2] = {0, 1};
+static const int rz0Slot = 3;
+static const int pqSlot = 2;
+
+ImplicitSolver::ImplicitSolver(size_t n, size_t pairCount):
+        n{n},
+        partialCount{(n + reduceGroupSize - 1) / reduceGroupSize},
+        jacobianBuffer{pairCount},
+        inverseDiagonalBuffer{n},
+        deltaVelocityBuffer{n},
+        residualBuffer{n},
+        preconditionedBuffer{n},
+        directionBuffer{n},
+        productBuffer{n},
+        partialBuffer{partialCount},
+        scalarBuffer{4},
+        assembleJacobianKernel{"assembleJacobian"},
+        rhsKernel{"implicitRhs", reduceGroupSize},
+        matVecKernel{"implicitMatVec", reduceGroupSize},
+        sumPartialsKernel{"sumPartials", reduceGroupSize},
+        updateKernel{"pcgUpdate", reduceGroupSize},
+        directionKernel{"pcgDirection"},
+        integrateKernel{"implicitIntegrate"}
+{
+}
+
+void ImplicitSolver::step(float dt, float damping, EventChain &chain,
+                          CLBuffer<cl_float4> &position, CLBuffer<cl_float4> &velocity,
+                          CLBuffer<cl_float> &inverseMass, CLBuffer<cl_float4> &force,
+                          CLBuffer<cl_int> &pairOffsets, CLBuffer<cl_int> &pairs, CLBuffer<cl_float2> &pairParams) {
+    if (!n) {
+        return;
+    }
+
+    int count = (int) n;
+    float dt2 = dt * dt;
+
+    assembleJacobianKernel.execute(chain, n, count, dt2, inverseMass, position, pairOffsets, pairs, pairParams,
+                                   jacobianBuffer, inverseDiagonalBuffer);
+
+    rhsKernel.execute(chain, n, count, dt, inverseMass, force, velocity, pairOffsets, pairs, jacobianBuffer,
+                      inverseDiagonalBuffer, deltaVelocityBuffer, residualBuffer, preconditionedBuffer,
+                      directionBuffer, partialBuffer);
+    sumPartialsKernel.execute(chain, reduceGroupSize, (int) partialCount, partialBuffer, scalarBuffer, rzSlots[0], rz0Slot);
+
+    for (int k = 0; k < iterations; ++k) {
+        int rz = rzSlots[k % 2];
+        int rzNew = rzSlots[(k + 1) % 2];
+
+        matVecKernel.execute(chain, n, count, dt2, inverseMass, pairOffsets, pairs, jacobianBuffer,
+                             directionBuffer, productBuffer, partialBuffer);
+        sumPartialsKernel.execute(chain, reduceGroupSize, (int) partialCount, partialBuffer, scalarBuffer, pqSlot, -1);
+
+        updateKernel.execute(chain, n, count, rz, tolerance * tolerance, scalarBuffer, inverseDiagonalBuffer,
+                             directionBuffer, productBuffer, deltaVelocityBuffer, residualBuffer,
+                             preconditionedBuffer, partialBuffer);
+        sumPartialsKernel.execute(chain, reduceGroupSize, (int) partialCount, partialBuffer, scalarBuffer, rzNew, -1);
+
+        directionKernel.execute(chain, n, count, rz, rzNew, scalarBuffer, preconditionedBuffer, directionBuffer);
+    }
+
+    integrateKernel.execute(chain, n, dt, damping, deltaVelocityBuffer, velocity, position);
+}
@@ -0,0 +1,57 @@
+#ifndef GPGPU_HF_IMPLICITSOLVER_H
+#define GPGPU_HF_IMPLICITSOLVER_H
+
+#include <CL/cl_platform.h>
+
+#include "CLBuffer.hpp"
+#include "CLKernel.hpp"
+
+// Backward Euler step for spring systems: assembles the spring Jacobian from
+// the CSR pair data and solves for the velocity change with a Jacobi
+// preconditioned conjugate gradient, entirely on the device (see the comment
+// above assembleJacobian in programs.cl). Nothing is read back; the
+// iteration count is fixed and converged iterations turn into no-ops.
+class ImplicitSolver {
+    size_t n;
+
+    // REDUCE_GROUP_SIZE in programs.cl
+    size_t reduceGroupSize = 128;
+    size_t partialCount;
+
+    CLBuffer<cl_float8> jacobianBuffer;
+    CLBuffer<cl_float4> inverseDiagonalBuffer;
+    CLBuffer<cl_float4> deltaVelocityBuffer;
+    CLBuffer<cl_float4> residualBuffer;
+    CLBuffer<cl_float4> preconditionedBuffer;
+    CLBuffer<cl_float4> directionBuffer;
+    CLBuffer<cl_float4> productBuffer;
+    CLBuffer<cl_float> partialBuffer;
+    CLBuffer<cl_float> scalarBuffer;
+
+    CLKernel<int, float, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem> assembleJacobianKernel;
+    CLKernel<int, float, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem> rhsKernel;
+    CLKernel<int, float, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem> matVecKernel;
+    CLKernel<int, cl_mem, cl_mem, int, int> sumPartialsKernel;
+    CLKernel<int, int, float, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem> updateKernel;
+    CLKernel<int, int, int, cl_mem, cl_mem, cl_mem> directionKernel;
+    CLKernel<float, float, cl_mem, cl_mem, cl_mem> integrateKernel;
+
+public:
+    // conjugate gradient iterations per step
+    int iterations = 20;
+
+    // relative residual (in the preconditioned norm) at which it stops improving
+    float tolerance = 1e-3f;
+
+    ImplicitSolver(size_t n, size_t pairCount);
+
+    // advances position and velocity by dt; force must already hold the total
+    // force at the current positions
+    void step(float dt, float damping, EventChain &chain,
+              CLBuffer<cl_float4> &position, CLBuffer<cl_float4> &velocity,
+              CLBuffer<cl_float> &inverseMass, CLBuffer<cl_float4> &force,
+              CLBuffer<cl_int> &pairOffsets, CLBuffer<cl_int> &pairs, CLBuffer<cl_float2> &pairParams);
+};
+
+
+#endif //GPGPU_HF_IMPLICITSOLVER_H
@@ -0,0 +1,90 @@
+#include "Integrator.hpp"
+
+#include <cctype>
+#include <iostream>
+
+static const char *integratorNames[integratorCount] = {"euler", "symplectic", "verlet", "rk4", "implicit", "xpbd"};
+
+const char *integratorName(Integrator integrator) {
+    return integratorNames[(int) integrator];
+}
+
+bool parseIntegrator(const std::string &name, Integrator &integrator) {
+    std::string lower = name;
+    for (auto &c : lower) c = (char) tolower((unsigned char) c);
+
+    for (int i = 0; i < integratorCount; ++i) {
+        if (lower == integratorNames[i]) {
+            integrator = (Integrator) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+TimeIntegrator::TimeIntegrator(size_t n):
+        n{n},
+        integrate1EulerKernel{"integrate1Euler"},
+        integrate2EulerKernel{"integrate2Euler"},
+        symplecticEulerKernel{"integrateSymplecticEuler"},
+        verletPositionsKernel{"verletPositions"},
+        verletVelocitiesKernel{"verletVelocities"},
+        rk4StageKernel{"rk4Stage"},
+        rk4FinishKernel{"rk4Finish"}
+{
+}
+
+void TimeIntegrator::setIntegrator(Integrator integrator) {
+    if (integrator == Integrator::BackwardEuler && !pairParams) {
+        std::cerr << "implicit integration needs springs, keeping " << integratorName(method) << std::endl;
+        return;
+    }
+    if (integrator == Integrator::XPBD) {
+        std::cerr << "xpbd needs a single volume mesh, keeping " << integratorName(method) << std::endl;
+        return;
+    }
+
+    method = integrator;
+    allocate();
+}
+
+void TimeIntegrator::setSprings(CLBuffer<cl_int> &pairOffsets, CLBuffer<cl_int> &pairs, CLBuffer<cl_float2> &pairParams) {
+    this->pairOffsets = &pairOffsets;
+    this->pairs = &pairs;
+    this->pairParams = &pairParams;
+
+    implicitSolver.reset();
+    allocate();
+}
+
+void TimeIntegrator::resize(size_t n) {
+    this->n = n;
+
+    nextForceBuffer.reset();
+    stagePositionBuffer.reset();
+    stageVelocityBuffer.reset();
+    sumPositionBuffer.reset();
+    sumVelocityBuffer.reset();
+    implicitSolver.reset();
+
+    allocate();
+}
+
+void TimeIntegrator::allocate() {
+    haveForce = false;
+
+    if (method == Integrator::VelocityVerlet && !nextForceBuffer) {
+        nextForceBuffer.reset(new CLBuffer<cl_float4>(n));
+    }
+
+    if (method == Integrator::RK4 && !stagePositionBuffer) {
+        stagePositionBuffer.reset(new CLBuffer<cl_float4>(n));
+        stageVelocityBuffer.reset(new CLBuffer<cl_float4>(n));
+        sumPositionBuffer.reset(new CLBuffer<cl_float4>(n));
+        sumVelocityBuffer.reset(new CLBuffer<cl_float4>(n));
+    }
+
+    if (method == Integrator::BackwardEuler && !implicitSolver) {
+        implicitSolver.reset(new ImplicitSolver(n, pairParams->size()));
+    }
+}
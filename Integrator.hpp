@@ -0,0 +1,171 @@
+#ifndef GPGPU_HF_INTEGRATOR_H
+#define GPGPU_HF_INTEGRATOR_H
+
+#include <cmath>
+#include <memory>
+#include <string>
+
+#include <CL/cl_platform.h>
+
+#include "CLBuffer.hpp"
+#include "CLKernel.hpp"
+#include "ImplicitSolver.hpp"
+
+enum class Integrator {
+    // the original explicit step with 0.999 damping per step, the only one stepFused implements
+    Euler,
+    // same update order, but with dt-based damping and in one kernel
+    SymplecticEuler,
+    // second order, one force evaluation per step (the last one is reused)
+    VelocityVerlet,
+    // fourth order, four force evaluations per step
+    RK4,
+    // implicit in the springs (ImplicitSolver), stable at large steps
+    BackwardEuler,
+    // position-based constraints instead of forces (XPBDSolver), only for VolumeMesh
+    XPBD
+};
+
+const int integratorCount = 6;
+
+const char *integratorName(Integrator integrator);
+
+// accepts the names printed by integratorName(), case insensitive
+bool parseIntegrator(const std::string &name, Integrator &integrator);
+
+// Kernels and scratch buffers to advance positions and velocities of n points
+// by one step of the selected integrator. The forces come from the object
+// through a callback, so the same code serves every kind of object.
+class TimeIntegrator {
+    size_t n;
+    Integrator method = Integrator::Euler;
+
+    // velocity Verlet: force holds the force at the current positions
+    bool haveForce = false;
+
+    std::unique_ptr<CLBuffer<cl_float4>> nextForceBuffer;
+    std::unique_ptr<CLBuffer<cl_float4>> stagePositionBuffer;
+    std::unique_ptr<CLBuffer<cl_float4>> stageVelocityBuffer;
+    std::unique_ptr<CLBuffer<cl_float4>> sumPositionBuffer;
+    std::unique_ptr<CLBuffer<cl_float4>> sumVelocityBuffer;
+
+    // backward Euler: the solver and the springs of the object
+    std::unique_ptr<ImplicitSolver> implicitSolver;
+    CLBuffer<cl_int> *pairOffsets = 0;
+    CLBuffer<cl_int> *pairs = 0;
+    CLBuffer<cl_float2> *pairParams = 0;
+
+    CLKernel<float, cl_mem, cl_mem, cl_mem, cl_mem> integrate1EulerKernel;
+    CLKernel<float, cl_mem, cl_mem, cl_mem> integrate2EulerKernel;
+    CLKernel<float, float, cl_mem, cl_mem, cl_mem, cl_mem> symplecticEulerKernel;
+    CLKernel<float, cl_mem, cl_mem, cl_mem, cl_mem> verletPositionsKernel;
+    CLKernel<float, float, cl_mem, cl_mem, cl_mem, cl_mem> verletVelocitiesKernel;
+    CLKernel<float, float, int, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem> rk4StageKernel;
+    CLKernel<float, float, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem> rk4FinishKernel;
+
+    // allocates the scratch buffers of the current method
+    void allocate();
+
+public:
+    // velocity decay per second of the non-Euler methods; 1 matches the 0.999
+    // per step of Euler at the usual dt of 0.001
+    float dampingRate = 1.0f;
+
+    TimeIntegrator(size_t n);
+
+    Integrator integrator() const { return method; }
+
+    void setIntegrator(Integrator integrator);
+
+    // the number of points changed, e.g. after repacking a world
+    void resize(size_t n);
+
+    // the springs (in MeshTopology layout) the backward Euler solver linearizes;
+    // must be set again whenever these buffers are replaced
+    void setSprings(CLBuffer<cl_int> &pairOffsets, CLBuffer<cl_int> &pairs, CLBuffer<cl_float2> &pairParams);
+
+    // the force kept from the last step is stale, e.g. because the positions
+    // were moved or the pressure changed outside of step()
+    void invalidateForce() { haveForce = false; }
+
+    // conjugate gradient iterations per backward Euler step
+    int implicitIterations = 20;
+
+    // computeForces(positions, force) has to enqueue writing the total force
+    // acting on every point at the given positions into force
+    template<typename ComputeForces>
+    void step(float dt, EventChain &chain,
+              CLBuffer<cl_float4> &position, CLBuffer<cl_float4> &velocity,
+              CLBuffer<cl_float> &inverseMass, CLBuffer<cl_float4> &force,
+              ComputeForces computeForces);
+};
+
+template<typename ComputeForces>
+void TimeIntegrator::step(float dt, EventChain &chain,
+                          CLBuffer<cl_float4> &position, CLBuffer<cl_float4> &velocity,
+                          CLBuffer<cl_float> &inverseMass, CLBuffer<cl_float4> &force,
+                          ComputeForces computeForces) {
+    float damping = std::exp(-dampingRate * dt);
+
+    switch (method) {
+        case Integrator::Euler:
+            computeForces(position, force);
+            integrate1EulerKernel.execute(chain, n, dt, inverseMass, velocity, force, velocity);
+            integrate2EulerKernel.execute(chain, n, dt, position, velocity, position);
+            break;
+
+        case Integrator::SymplecticEuler:
+            computeForces(position, force);
+            symplecticEulerKernel.execute(chain, n, dt, damping, inverseMass, force, velocity, position);
+            break;
+
+        case Integrator::VelocityVerlet:
+            if (!haveForce) {
+                computeForces(position, force);
+            }
+            verletPositionsKernel.execute(chain, n, dt, inverseMass, force, velocity, position);
+            computeForces(position, *nextForceBuffer);
+            verletVelocitiesKernel.execute(chain, n, dt, damping, inverseMass, force, *nextForceBuffer, velocity);
+
+            // the new force is the old one of the next step
+            force.swap(*nextForceBuffer);
+            haveForce = true;
+            break;
+
+        case Integrator::RK4: {
+            CLBuffer<cl_float4> &stagePosition = *stagePositionBuffer;
+            CLBuffer<cl_float4> &stageVelocity = *stageVelocityBuffer;
+
+            computeForces(position, force);
+            rk4StageKernel.execute(chain, n, dt / 2, 1.0f, 1, inverseMass, position, velocity, force,
+                                   stagePosition, stageVelocity, *sumPositionBuffer, *sumVelocityBuffer);
+
+            computeForces(stagePosition, force);
+            rk4StageKernel.execute(chain, n, dt / 2, 2.0f, 0, inverseMass, position, velocity, force,
+                                   stagePosition, stageVelocity, *sumPositionBuffer, *sumVelocityBuffer);
+
+            computeForces(stagePosition, force);
+            rk4StageKernel.execute(chain, n, dt, 2.0f, 0, inverseMass, position, velocity, force,
+                                   stagePosition, stageVelocity, *sumPositionBuffer, *sumVelocityBuffer);
+
+            computeForces(stagePosition, force);
+            rk4FinishKernel.execute(chain, n, dt, damping, inverseMass, force, stageVelocity,
+                                    *sumPositionBuffer, *sumVelocityBuffer, velocity, position);
+            break;
+        }
+
+        case Integrator::BackwardEuler:
+            computeForces(position, force);
+            implicitSolver->iterations = implicitIterations;
+            implicitSolver->step(dt, damping, chain, position, velocity, inverseMass, force,
+                                 *pairOffsets, *pairs, *pairParams);
+            break;
+
+        case Integrator::XPBD:
+            // not force based, setIntegrator() refuses it
+            break;
+    }
+}
+
+
+#endif //GPGPU_HF_INTEGRATOR_H
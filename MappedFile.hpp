@@ -0,0 +1,29 @@
+#ifndef GPGPU_HF_MAPPEDFILE_H
+#define GPGPU_HF_MAPPEDFILE_H
+
+#include <cstddef>
+#include <string>
+
+// Read-only memory mapping of a whole file.
+class MappedFile {
+    const char *mapped = 0;
+    size_t length = 0;
+
+public:
+    MappedFile(const std::string &filename);
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile();
+
+    // false if the file could not be opened or mapped
+    bool valid() const { return mapped != 0; }
+
+    const char *data() const { return mapped; }
+
+    size_t size() const { return length; }
+};
+
+
+#endif //GPGPU_HF_MAPPEDFILE_H
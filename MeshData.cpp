@@ -0,0 +1,252 @@
+#include "MeshData.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool MeshData::useCache = true;
+
+// bump whenever the layout or the preprocessing changes
+static const uint32_t cacheVersion = 2;
+
+enum CacheArray {
+    POINTS, EDGES, FACES, ORIGINAL_INDEX,
+    PAIR_OFFSETS, PAIRS, PAIR_PARAMS,
+    CORNER_OFFSETS, OTHER_CORNERS,
+    CONSTRAINTS, CONSTRAINT_PARAMS, COLOR_OFFSETS,
+    ARRAY_COUNT
+};
+
+struct CacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reordered;
+    uint64_t sourceSize;
+    int64_t sourceMtime;
+    float strength;
+    uint32_t padding;
+    // byte offset from the start of the file and element count of every array
+    uint64_t offset[ARRAY_COUNT];
+    uint64_t count[ARRAY_COUNT];
+};
+
+static const char cacheMagic[8] = {'G', 'P', 'G', 'P', 'U', 'H', 'F', 'M'};
+
+static bool sourceStat(const std::string &source, uint64_t &size, int64_t &mtime) {
+    struct stat st;
+    if (stat(source.c_str(), &st) != 0) {
+        return false;
+    }
+    size = (uint64_t) st.st_size;
+    mtime = (int64_t) st.st_mtime;
+    return true;
+}
+
+template<typename T>
+static bool cachedArray(const MappedFile &file, const CacheHeader &header, CacheArray which, ArrayView<T> &view) {
+    uint64_t offset = header.offset[which];
+    uint64_t count = header.count[which];
+    if (offset % 16 || offset > file.size() || count > (file.size() - offset) / sizeof(T)) {
+        return false;
+    }
+    view = ArrayView<T>((const T *) (file.data() + offset), count);
+    return true;
+}
+
+static bool below(cl_int i, size_t n) {
+    return i >= 0 && (size_t) i < n;
+}
+
+static bool below(const cl_int2 &e, size_t n) {
+    return below(e.s[0], n) && below(e.s[1], n);
+}
+
+// the fourth index of a face is padding
+static bool below(const cl_int4 &f, size_t n) {
+    return below(f.s[0], n) && below(f.s[1], n) && below(f.s[2], n);
+}
+
+// every point index in view is in [0, n)
+template<typename T>
+static bool allBelow(const ArrayView<T> &view, size_t n) {
+    for (const auto &x : view) {
+        if (!below(x, n)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// CSR offsets: starting at 0, never decreasing and ending at end
+static bool validOffsets(const ArrayView<cl_int> &offsets, size_t end) {
+    if (offsets.empty() || offsets[0] != 0 || (size_t) offsets[offsets.size() - 1] != end) {
+        return false;
+    }
+    for (size_t i = 1; i < offsets.size(); ++i) {
+        if (offsets[i] < offsets[i - 1]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+MeshData::MeshData(const std::string &filename, float strength) {
+    std::string cachePath = filename + ".meshcache";
+
+    if (useCache && readCache(cachePath, filename, strength)) {
+        std::cout << "Loaded " <<
+                points.size() << " points, " <<
+                edges.size() << " edges and " <<
+                faces.size() << " faces " <<
+                "from " << cachePath << std::endl;
+        return;
+    }
+
+    obj.reset(new ObjLoader(filename));
+    topology.reset(new MeshTopology(*obj, strength));
+
+    points = obj->points;
+    edges = obj->edges;
+    faces = obj->faces;
+    originalIndex = obj->originalIndex;
+
+    pairOffsets = topology->pairOffsets;
+    pairs = topology->pairs;
+    pairParams = topology->pairParams;
+
+    cornerOffsets = topology->cornerOffsets;
+    otherCorners = topology->otherCorners;
+
+    constraints = topology->constraints;
+    constraintParams = topology->constraintParams;
+    colorOffsets = topology->colorOffsets;
+
+    if (useCache) {
+        writeCache(cachePath, filename, strength);
+    }
+}
+
+float MeshData::volume() const {
+    double volume = 0;
+    for (const auto &f : faces) {
+        const cl_float4 &a = points[f.s[0]];
+        const cl_float4 &b = points[f.s[1]];
+        const cl_float4 &c = points[f.s[2]];
+
+        // a . (b x c), as faceVolume in programs.cl
+        volume += (double) a.s[0] * (b.s[1] * c.s[2] - b.s[2] * c.s[1]) +
+                  (double) a.s[1] * (b.s[2] * c.s[0] - b.s[0] * c.s[2]) +
+                  (double) a.s[2] * (b.s[0] * c.s[1] - b.s[1] * c.s[0]);
+    }
+    return (float) (volume / 6);
+}
+
+bool MeshData::readCache(const std::string &path, const std::string &source, float strength) {
+    uint64_t sourceSize;
+    int64_t sourceMtime;
+    if (!sourceStat(source, sourceSize, sourceMtime)) {
+        return false;
+    }
+
+    std::unique_ptr<MappedFile> file(new MappedFile(path));
+    if (!file->valid() || file->size() < sizeof(CacheHeader)) {
+        return false;
+    }
+
+    CacheHeader header;
+    memcpy(&header, file->data(), sizeof(header));
+
+    if (memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) || header.version != cacheVersion ||
+        header.reordered != (uint32_t) ObjLoader::reorderPoints ||
+        header.sourceSize != sourceSize || header.sourceMtime != sourceMtime ||
+        header.strength != strength) {
+        return false;
+    }
+
+    bool ok = cachedArray(*file, header, POINTS, points) &&
+              cachedArray(*file, header, EDGES, edges) &&
+              cachedArray(*file, header, FACES, faces) &&
+              cachedArray(*file, header, ORIGINAL_INDEX, originalIndex) &&
+              cachedArray(*file, header, PAIR_OFFSETS, pairOffsets) &&
+              cachedArray(*file, header, PAIRS, pairs) &&
+              cachedArray(*file, header, PAIR_PARAMS, pairParams) &&
+              cachedArray(*file, header, CORNER_OFFSETS, cornerOffsets) &&
+              cachedArray(*file, header, OTHER_CORNERS, otherCorners) &&
+              cachedArray(*file, header, CONSTRAINTS, constraints) &&
+              cachedArray(*file, header, CONSTRAINT_PARAMS, constraintParams) &&
+              cachedArray(*file, header, COLOR_OFFSETS, colorOffsets);
+
+    ok = ok && originalIndex.size() == points.size() &&
+         pairOffsets.size() == points.size() + 1 && cornerOffsets.size() == points.size() + 1 &&
+         pairParams.size() == pairs.size() && constraintParams.size() == constraints.size() &&
+         validOffsets(pairOffsets, pairs.size()) && validOffsets(cornerOffsets, otherCorners.size()) &&
+         validOffsets(colorOffsets, constraints.size());
+
+    // a truncated or corrupted file of the right size must not index out of
+    // bounds later, on the host or in the kernels
+    size_t n = points.size();
+    ok = ok && allBelow(edges, n) && allBelow(faces, n) && allBelow(originalIndex, n) &&
+         allBelow(pairs, n) && allBelow(otherCorners, n) && allBelow(constraints, n);
+
+    if (!ok) {
+        std::cerr << "Ignoring broken mesh cache " << path << std::endl;
+        points = ArrayView<cl_float4>();
+        return false;
+    }
+
+    cache = std::move(file);
+    return true;
+}
+
+template<typename T>
+static void appendArray(std::vector<char> &out, CacheHeader &header, CacheArray which, const ArrayView<T> &view) {
+    out.resize((out.size() + 15) / 16 * 16, 0);
+    header.offset[which] = out.size();
+    header.count[which] = view.size();
+    out.insert(out.end(), (const char *) view.begin(), (const char *) view.end());
+}
+
+void MeshData::writeCache(const std::string &path, const std::string &source, float strength) const {
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+    header.version = cacheVersion;
+    header.reordered = ObjLoader::reorderPoints;
+    header.strength = strength;
+    if (!sourceStat(source, header.sourceSize, header.sourceMtime)) {
+        return;
+    }
+
+    std::vector<char> out(sizeof(header));
+    appendArray(out, header, POINTS, points);
+    appendArray(out, header, EDGES, edges);
+    appendArray(out, header, FACES, faces);
+    appendArray(out, header, ORIGINAL_INDEX, originalIndex);
+    appendArray(out, header, PAIR_OFFSETS, pairOffsets);
+    appendArray(out, header, PAIRS, pairs);
+    appendArray(out, header, PAIR_PARAMS, pairParams);
+    appendArray(out, header, CORNER_OFFSETS, cornerOffsets);
+    appendArray(out, header, OTHER_CORNERS, otherCorners);
+    appendArray(out, header, CONSTRAINTS, constraints);
+    appendArray(out, header, CONSTRAINT_PARAMS, constraintParams);
+    appendArray(out, header, COLOR_OFFSETS, colorOffsets);
+    memcpy(out.data(), &header, sizeof(header));
+
+    // written under a unique name and renamed, so nobody ever maps a half written cache
+    std::string tmp = path + ".XXXXXX";
+    int fd = mkstemp(&tmp[0]);
+    if (fd < 0) {
+        return;
+    }
+    fchmod(fd, 0644);
+
+    bool ok = write(fd, out.data(), out.size()) == (ssize_t) out.size();
+    ok = (close(fd) == 0) && ok;
+
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        unlink(tmp.c_str());
+    }
+}
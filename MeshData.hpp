@@ -0,0 +1,80 @@
+#ifndef GPGPU_HF_MESHDATA_H
+#define GPGPU_HF_MESHDATA_H
+
+#include <memory>
+#include <string>
+
+#include <CL/cl.h>
+
+#include "ObjLoader.hpp"
+#include "MeshTopology.hpp"
+#include "MappedFile.hpp"
+
+// Read-only view of an array owned by someone else.
+template<typename T>
+class ArrayView {
+    const T *ptr = 0;
+    size_t count = 0;
+
+public:
+    ArrayView() {}
+
+    ArrayView(const T *ptr, size_t count) : ptr{ptr}, count{count} {}
+
+    ArrayView(const std::vector<T> &v) : ptr{v.data()}, count{v.size()} {}
+
+    const T *data() const { return ptr; }
+
+    size_t size() const { return count; }
+
+    bool empty() const { return count == 0; }
+
+    const T &operator[](size_t i) const { return ptr[i]; }
+
+    const T *begin() const { return ptr; }
+
+    const T *end() const { return ptr + count; }
+};
+
+// Everything the simulated objects need from a mesh file: the parsed and
+// preprocessed geometry plus the adjacency tables in device layout.
+//
+// The first load of a file parses the OBJ, builds all springs and writes the
+// result to <file>.meshcache next to it; later loads map that cache and the
+// views below point straight into the mapping.
+class MeshData {
+    std::unique_ptr<ObjLoader> obj;
+    std::unique_ptr<MeshTopology> topology;
+    std::unique_ptr<MappedFile> cache;
+
+    bool readCache(const std::string &path, const std::string &source, float strength);
+    void writeCache(const std::string &path, const std::string &source, float strength) const;
+
+public:
+    MeshData(const std::string &filename, float strength);
+
+    ArrayView<cl_float4> points;
+    ArrayView<cl_int2> edges;
+    ArrayView<cl_int4> faces;
+    ArrayView<cl_int> originalIndex;
+
+    ArrayView<cl_int> pairOffsets;
+    ArrayView<cl_int> pairs;
+    ArrayView<cl_float2> pairParams;
+
+    ArrayView<cl_int> cornerOffsets;
+    ArrayView<cl_int2> otherCorners;
+
+    ArrayView<cl_int2> constraints;
+    ArrayView<cl_float2> constraintParams;
+    ArrayView<cl_int> colorOffsets;
+
+    // signed volume enclosed by the faces at the loaded positions
+    float volume() const;
+
+    // whether caches are read and written at all
+    static bool useCache;
+};
+
+
+#endif //GPGPU_HF_MESHDATA_H
@@ -0,0 +1,86 @@
+#include "MeshLoader.hpp"
+
+#include <algorithm>
+#include <exception>
+#include <iostream>
+
+MeshLoader::MeshLoader(float strength, size_t threads) : strength{strength} {
+    for (size_t i = 0; i < std::max<size_t>(threads, 1); ++i) {
+        workers.emplace_back(&MeshLoader::run, this);
+    }
+}
+
+MeshLoader::~MeshLoader() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        queue.clear();
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (auto &w : workers) {
+        w.join();
+    }
+}
+
+void MeshLoader::load(const std::string &filename) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        queue.push_back(filename);
+    }
+    wake.notify_one();
+}
+
+std::vector<std::unique_ptr<MeshData>> MeshLoader::finished() {
+    std::lock_guard<std::mutex> guard(lock);
+
+    std::vector<std::unique_ptr<MeshData>> result;
+    result.swap(done);
+    return result;
+}
+
+void MeshLoader::discardPending() {
+    std::lock_guard<std::mutex> guard(lock);
+
+    queue.clear();
+    done.clear();
+    ++generation;
+}
+
+size_t MeshLoader::pending() {
+    std::lock_guard<std::mutex> guard(lock);
+
+    return queue.size() + running;
+}
+
+void MeshLoader::run() {
+    for (;;) {
+        std::string filename;
+        uint64_t started;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            wake.wait(guard, [this] { return stopping || !queue.empty(); });
+            if (stopping) {
+                return;
+            }
+
+            filename = queue.front();
+            queue.pop_front();
+            started = generation;
+            ++running;
+        }
+
+        std::unique_ptr<MeshData> mesh;
+        try {
+            mesh.reset(new MeshData(filename, strength));
+        } catch (const std::exception &e) {
+            std::cerr << "Loading " << filename << " failed: " << e.what() << std::endl;
+        }
+
+        std::lock_guard<std::mutex> guard(lock);
+        --running;
+        if (mesh && started == generation) {
+            done.push_back(std::move(mesh));
+        }
+    }
+}
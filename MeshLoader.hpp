@@ -0,0 +1,60 @@
+#ifndef GPGPU_HF_MESHLOADER_H
+#define GPGPU_HF_MESHLOADER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MeshData.hpp"
+
+// Parses and preprocesses meshes (or maps their caches) on worker threads, so
+// spawning an object does not stall the frame loop. Several loads run at
+// once; the main thread collects the finished ones at a frame boundary and
+// creates the OpenCL objects from them.
+class MeshLoader {
+public:
+    // strength of the springs of every mesh it loads
+    MeshLoader(float strength, size_t threads = 2);
+
+    MeshLoader(const MeshLoader &) = delete;
+    MeshLoader &operator=(const MeshLoader &) = delete;
+
+    // waits for the loads in progress, drops the queued ones
+    ~MeshLoader();
+
+    void load(const std::string &filename);
+
+    // the meshes finished since the last call, in the order they finished
+    std::vector<std::unique_ptr<MeshData>> finished();
+
+    // forgets every queued and running load, e.g. when the scene is cleared
+    void discardPending();
+
+    // loads queued or running
+    size_t pending();
+
+private:
+    float strength;
+
+    std::vector<std::thread> workers;
+
+    std::mutex lock;
+    std::condition_variable wake;
+    std::deque<std::string> queue;
+    std::vector<std::unique_ptr<MeshData>> done;
+    size_t running = 0;
+
+    // bumped by discardPending(); loads started before are thrown away
+    uint64_t generation = 0;
+    bool stopping = false;
+
+    void run();
+};
+
+
+#endif //GPGPU_HF_MESHLOADER_H
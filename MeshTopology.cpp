@@ -0,0 +1,174 @@
+#include "MeshTopology.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+
+// turns per-point counts (shifted by one) into offsets
+static void prefixSum(std::vector<cl_int> &offsets) {
+    for (size_t i = 1; i < offsets.size(); ++i) {
+        offsets[i] += offsets[i - 1];
+    }
+}
+
+MeshTopology::MeshTopology(const ObjLoader &obj, float strength) :
+        pairOffsets(obj.points.size() + 1, 0),
+        cornerOffsets(obj.points.size() + 1, 0)
+{
+    for (const auto &e : obj.edges) {
+        ++pairOffsets[e.s[0] + 1];
+        ++pairOffsets[e.s[1] + 1];
+    }
+    prefixSum(pairOffsets);
+
+    pairs.resize(pairOffsets.back());
+    pairParams.resize(pairOffsets.back());
+
+    // filled in edge order, so every point sees its springs in the same order as before
+    std::vector<cl_int> fill(pairOffsets.begin(), pairOffsets.end() - 1);
+
+    for (const auto &e : obj.edges) {
+        int a = e.s[0];
+        int b = e.s[1];
+
+        const auto &pa = obj.points[a];
+        const auto &pb = obj.points[b];
+
+        float dx = pa.s[0] - pb.s[0];
+        float dy = pa.s[1] - pb.s[1];
+        float dz = pa.s[2] - pb.s[2];
+
+        cl_float2 params;
+        params.s[0] = sqrtf(dx*dx + dy*dy + dz*dz);
+        params.s[1] = strength;
+
+        pairs[fill[a]] = b;
+        pairParams[fill[a]++] = params;
+
+        pairs[fill[b]] = a;
+        pairParams[fill[b]++] = params;
+    }
+
+    for (const auto &f : obj.faces) {
+        ++cornerOffsets[f.s[0] + 1];
+        ++cornerOffsets[f.s[1] + 1];
+        ++cornerOffsets[f.s[2] + 1];
+    }
+    prefixSum(cornerOffsets);
+
+    otherCorners.resize(cornerOffsets.back());
+
+    fill.assign(cornerOffsets.begin(), cornerOffsets.end() - 1);
+
+    for (const auto &f : obj.faces) {
+        int a = f.s[0];
+        int b = f.s[1];
+        int c = f.s[2];
+
+        otherCorners[fill[a]].s[0] = b;
+        otherCorners[fill[a]++].s[1] = c;
+
+        otherCorners[fill[b]].s[0] = c;
+        otherCorners[fill[b]++].s[1] = a;
+
+        otherCorners[fill[c]].s[0] = a;
+        otherCorners[fill[c]++].s[1] = b;
+    }
+
+    buildConstraints(obj, strength);
+}
+
+void MeshTopology::buildConstraints(const ObjLoader &obj, float strength) {
+    size_t n = obj.points.size();
+
+    // the same edge may appear several times (once per face and direction),
+    // merged in the order of first appearance to keep the locality of the points
+    std::unordered_map<uint64_t, size_t> index;
+    std::vector<cl_int2> unique;
+    std::vector<int> multiplicity;
+
+    for (const auto &e : obj.edges) {
+        cl_int a = std::min(e.s[0], e.s[1]);
+        cl_int b = std::max(e.s[0], e.s[1]);
+        if (a == b) {
+            continue;
+        }
+
+        uint64_t key = (uint64_t) a << 32 | (uint32_t) b;
+        auto found = index.find(key);
+        if (found != index.end()) {
+            ++multiplicity[found->second];
+            continue;
+        }
+
+        index[key] = unique.size();
+        cl_int2 edge = {{a, b}};
+        unique.push_back(edge);
+        multiplicity.push_back(1);
+    }
+
+    // greedy edge coloring: every edge gets the lowest color none of the edges
+    // at its endpoints has, which needs at most 2 * maxDegree - 1 colors
+    std::vector<int> degree(n, 0);
+    for (const auto &e : unique) {
+        ++degree[e.s[0]];
+        ++degree[e.s[1]];
+    }
+    int maxDegree = n ? *std::max_element(degree.begin(), degree.end()) : 0;
+    size_t words = (size_t) (2 * maxDegree + 63) / 64;
+
+    // bit c of used[point * words ..] is set if an edge of color c touches point
+    std::vector<uint64_t> used(n * words, 0);
+    std::vector<int> color(unique.size());
+    int colorCount = 0;
+
+    for (size_t k = 0; k < unique.size(); ++k) {
+        uint64_t *ua = &used[unique[k].s[0] * words];
+        uint64_t *ub = &used[unique[k].s[1] * words];
+
+        size_t w = 0;
+        while (~(ua[w] | ub[w]) == 0) {
+            ++w;
+        }
+        uint64_t free = ~(ua[w] | ub[w]);
+        int bit = 0;
+        while (!(free >> bit & 1)) {
+            ++bit;
+        }
+
+        ua[w] |= (uint64_t) 1 << bit;
+        ub[w] |= (uint64_t) 1 << bit;
+        color[k] = (int) (w * 64 + bit);
+        colorCount = std::max(colorCount, color[k] + 1);
+    }
+
+    // stable counting sort by color
+    colorOffsets.assign(colorCount + 1, 0);
+    for (int c : color) {
+        ++colorOffsets[c + 1];
+    }
+    prefixSum(colorOffsets);
+
+    constraints.resize(unique.size());
+    constraintParams.resize(unique.size());
+
+    std::vector<cl_int> fill(colorOffsets.begin(), colorOffsets.end() - 1);
+
+    for (size_t k = 0; k < unique.size(); ++k) {
+        const auto &pa = obj.points[unique[k].s[0]];
+        const auto &pb = obj.points[unique[k].s[1]];
+
+        float dx = pa.s[0] - pb.s[0];
+        float dy = pa.s[1] - pb.s[1];
+        float dz = pa.s[2] - pb.s[2];
+
+        cl_float2 params;
+        params.s[0] = sqrtf(dx*dx + dy*dy + dz*dz);
+        params.s[1] = 1.0f / (strength * multiplicity[k]);
+
+        int slot = fill[color[k]]++;
+        constraints[slot] = unique[k];
+        constraintParams[slot] = params;
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef GPGPU_HF_MESHTOPOLOGY_H
+#define GPGPU_HF_MESHTOPOLOGY_H
+
+#include <vector>
+
+#include <CL/cl.h>
+
+#include "ObjLoader.hpp"
+
+// Per-vertex adjacency of a loaded mesh in compressed sparse row layout,
+// exactly as the kernels read it.
+class MeshTopology {
+public:
+    MeshTopology(const ObjLoader &obj, float strength);
+
+    // springs of point i are pairs[pairOffsets[i] .. pairOffsets[i + 1]),
+    // every edge is stored at both of its endpoints
+    std::vector<cl_int> pairOffsets;
+    std::vector<cl_int> pairs;
+    // rest length, strength
+    std::vector<cl_float2> pairParams;
+
+    // the two other corners of the faces around point i are
+    // otherCorners[cornerOffsets[i] .. cornerOffsets[i + 1]), in winding order
+    std::vector<cl_int> cornerOffsets;
+    std::vector<cl_int2> otherCorners;
+
+    // every edge once, as an XPBD distance constraint, with its rest length and
+    // compliance (the inverse of the summed strength of its springs). Sorted by
+    // color: the constraints[colorOffsets[c] .. colorOffsets[c + 1]) of one
+    // color share no point, so they can be projected in parallel.
+    std::vector<cl_int2> constraints;
+    std::vector<cl_float2> constraintParams;
+    std::vector<cl_int> colorOffsets;
+
+private:
+    void buildConstraints(const ObjLoader &obj, float strength);
+};
+
+
+#endif //GPGPU_HF_MESHTOPOLOGY_H
@@ -0,0 +1,156 @@
+#include "NativeVolumeMesh.hpp"
+
+#include <iostream>
+
+#include "Integrator.hpp"
+#include "VolumeMesh.hpp"
+#include "Vec4.hpp"
+
+// indices per range handed to a thread
+static const size_t pointGrain = 1024;
+static const size_t faceGrain = 4096;
+
+static const Vec4 gravity(0, 0, -10, 0);
+
+NativeVolumeMesh::NativeVolumeMesh(const std::string &filename) :
+        NativeVolumeMesh(MeshData(filename, VolumeMesh::springStrength)) {
+}
+
+NativeVolumeMesh::NativeVolumeMesh(MeshData &&loaded):
+        mesh{std::move(loaded)},
+        positions(mesh.points.begin(), mesh.points.end()),
+        nextPositions(mesh.points.size()),
+        velocities(mesh.points.size(), cl_float4{{0, 0, 0, 0}}),
+        inverseMass(mesh.points.size(), 10),
+        normals(mesh.points.size()),
+        volumePartials((mesh.faces.size() + faceGrain - 1) / faceGrain),
+        pool(ThreadPool::shared())
+{
+    initVolume = calcVolume();
+}
+
+float NativeVolumeMesh::calcVolume() {
+    pool.parallelFor(mesh.faces.size(), faceGrain, [this](size_t begin, size_t end) {
+        float volume = 0;
+        for (size_t i = begin; i < end; ++i) {
+            const cl_int4 &f = mesh.faces[i];
+            Vec4 a = Vec4::load(positions[f.s[0]]);
+            Vec4 b = Vec4::load(positions[f.s[1]]);
+            Vec4 c = Vec4::load(positions[f.s[2]]);
+            volume += a.dot(b.cross(c)) / 6.0f;
+        }
+        volumePartials[begin / faceGrain] = volume;
+    });
+
+    float volume = 0;
+    for (float v : volumePartials) {
+        volume += v;
+    }
+    return volume;
+}
+
+// stepFusedPoint for a range of points: the force is kept in registers, the
+// positions of the neighbours are the ones from the start of the step
+void NativeVolumeMesh::step(float dt) {
+    float pressureDiff = initVolume - calcVolume();
+
+    pool.parallelFor(mesh.points.size(), pointGrain, [this, dt, pressureDiff](size_t begin, size_t end) {
+        for (size_t point = begin; point < end; ++point) {
+            Vec4 position = Vec4::load(positions[point]);
+            float invMass = inverseMass[point];
+
+            Vec4 force;
+            if (invMass > 1e-5f) {
+                force = gravity * (1.0f / invMass);
+            }
+
+            for (int i = mesh.pairOffsets[point]; i < mesh.pairOffsets[point + 1]; ++i) {
+                Vec4 toOther = Vec4::load(positions[mesh.pairs[i]]) - position;
+                float dist = toOther.length();
+                if (dist < 1e-5f) continue;
+
+                const cl_float2 &params = mesh.pairParams[i];
+                force = force.madd(toOther, params.s[1] * (dist - params.s[0]) / dist);
+            }
+
+            for (int i = mesh.cornerOffsets[point]; i < mesh.cornerOffsets[point + 1]; ++i) {
+                const cl_int2 &others = mesh.otherCorners[i];
+                Vec4 b = Vec4::load(positions[others.s[0]]) - position;
+                Vec4 c = Vec4::load(positions[others.s[1]]) - position;
+                force = force.madd(b.cross(c), pressureDiff * 20000);
+            }
+
+            Vec4 velocity = Vec4::load(velocities[point]).madd(force, dt * invMass);
+            position = position.madd(velocity, dt);
+
+            // collidePlane
+            cl_float4 p, v;
+            position.store(p);
+            velocity.store(v);
+            if (p.s[2] < -p.s[0] * 0.3f) {
+                p.s[2] = -p.s[0] * 0.3f;
+                v.s[2] = 0.0f;
+                for (auto &c : v.s) c *= 0.5f;
+            }
+            for (auto &c : v.s) c *= 0.999f;
+
+            nextPositions[point] = p;
+            velocities[point] = v;
+        }
+    });
+
+    positions.swap(nextPositions);
+    normalsDirty = true;
+}
+
+void NativeVolumeMesh::calcNormals() {
+    pool.parallelFor(mesh.points.size(), pointGrain, [this](size_t begin, size_t end) {
+        for (size_t point = begin; point < end; ++point) {
+            Vec4 a = Vec4::load(positions[point]);
+            Vec4 normal;
+
+            for (int i = mesh.cornerOffsets[point]; i < mesh.cornerOffsets[point + 1]; ++i) {
+                const cl_int2 &others = mesh.otherCorners[i];
+                Vec4 cp = (Vec4::load(positions[others.s[0]]) - a).cross(Vec4::load(positions[others.s[1]]) - a);
+                float len = cp.length();
+                if (len > 0) {
+                    normal += cp * (1.0f / len);
+                }
+            }
+
+            float len = normal.length();
+            (len > 0 ? normal * (1.0f / len) : normal).store(normals[point]);
+        }
+    });
+
+    normalsDirty = false;
+}
+
+void NativeVolumeMesh::readPositions(std::vector<cl_float4> &positions) {
+    positions.resize(mesh.points.size());
+    for (size_t i = 0; i < mesh.points.size(); ++i) {
+        positions[mesh.originalIndex[i]] = this->positions[i];
+    }
+}
+
+void NativeVolumeMesh::render() {
+    if (normalsDirty) {
+        calcNormals();
+    }
+
+    rendered.submit(mesh, positions.data(), normals.data());
+}
+
+void NativeVolumeMesh::inflate(float dt) {
+    initVolume += dt * 10;
+}
+
+void NativeVolumeMesh::deflate(float dt) {
+    initVolume -= dt * 10;
+}
+
+void NativeVolumeMesh::setIntegrator(Integrator integrator) {
+    if (integrator != Integrator::Euler) {
+        std::cerr << "the native backend only has euler, ignoring " << integratorName(integrator) << std::endl;
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef GPGPU_HF_NATIVEVOLUMEMESH_H
+#define GPGPU_HF_NATIVEVOLUMEMESH_H
+
+#include <string>
+#include <vector>
+
+#include <CL/cl_platform.h>
+
+#include "MeshData.hpp"
+#include "AbstractObject.hpp"
+#include "ThreadPool.hpp"
+#include "RenderedMesh.hpp"
+
+// VolumeMesh computed on the host: the Euler pipeline of programs.cl
+// (calcForces, calcVolumes, applyPressure, integrate1Euler, integrate2Euler
+// and calcNormals) in C++ with Vec4, the points split over the threads of
+// ThreadPool::shared(). It never touches OpenCL, so it runs without any
+// device, and it is the reference gpgpu_bench --validate compares against.
+class NativeVolumeMesh : public AbstractObject {
+    MeshData mesh;
+
+    float initVolume;
+
+    std::vector<cl_float4> positions;
+    std::vector<cl_float4> nextPositions;
+    std::vector<cl_float4> velocities;
+    std::vector<cl_float> inverseMass;
+    std::vector<cl_float4> normals;
+
+    // per range of faces, summed in a fixed order so the result does not
+    // depend on the timing of the threads
+    std::vector<float> volumePartials;
+
+    // normals are only computed when something renders
+    bool normalsDirty = true;
+
+    ThreadPool &pool;
+
+    RenderedMesh rendered;
+
+    float calcVolume();
+    void calcNormals();
+
+public:
+    NativeVolumeMesh(const std::string &filename);
+
+    // takes over a mesh loaded elsewhere, e.g. by a MeshLoader
+    NativeVolumeMesh(MeshData &&loaded);
+
+    float getVolume() { return calcVolume(); }
+
+    void step(float dt);
+    void render();
+
+    size_t vertexCount() const { return mesh.points.size(); }
+
+    void readPositions(std::vector<cl_float4> &positions);
+
+    void inflate(float dt) override;
+    void deflate(float dt) override;
+
+    // only Euler is implemented
+    void setIntegrator(Integrator integrator) override;
+};
+
+
+#endif //GPGPU_HF_NATIVEVOLUMEMESH_H
@@ -1,19 +1,161 @@
 #include "ObjLoader.hpp"
+#include "MappedFile.hpp"
 
 #include <iostream>
 #include <CL/cl_platform.h>
 #include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <thread>
+#include <unordered_map>
+
+bool ObjLoader::reorderPoints = true;
 
 ObjLoader::ObjLoader(std::string filename) {
-    std::ifstream f(filename);
-    while (!f.eof()) {
-        std::string line;
-        std::getline(f, line);
+    if (!parse_file(filename)) {
+        std::ifstream f(filename);
+        parse_stream(f);
+    }
+
+    std::cout << "Loaded " <<
+            points.size() << " points, " <<
+            edges.size() << " edges and " <<
+            faces.size() << " faces " <<
+            "from " << filename << std::endl;
+
+    originalIndex.resize(points.size());
+    for (size_t i = 0; i < points.size(); ++i) {
+        originalIndex[i] = (cl_int) i;
+    }
+
+    add_faces_as_edges();
+    //connect_neighbors();
+    connect_opposites();
+    //connect_neighbors(0.001, 0.3);
+
+    if (reorderPoints) {
+        reorder_points();
+    }
+}
+
+// CSR point-to-neighbours list of the springs: the neighbours of point p are
+// adjacent[offsets[p] .. offsets[p + 1])
+void ObjLoader::build_adjacency(std::vector<int> &offsets, std::vector<int> &adjacent) const {
+    size_t n = points.size();
+
+    offsets.assign(n + 1, 0);
+    for (const auto &e : edges) {
+        ++offsets[e.s[0] + 1];
+        ++offsets[e.s[1] + 1];
+    }
+    for (size_t i = 0; i < n; ++i) {
+        offsets[i + 1] += offsets[i];
+    }
+    adjacent.resize(offsets[n]);
+    std::vector<int> fill(offsets.begin(), offsets.end() - 1);
+    for (const auto &e : edges) {
+        adjacent[fill[e.s[0]]++] = e.s[1];
+        adjacent[fill[e.s[1]]++] = e.s[0];
+    }
+}
 
-        if (f.eof()) {
-            break;
+// Reverse Cuthill-McKee ordering of the spring graph: points connected by a
+// spring get nearby indices, so the neighbour reads of the kernels stay
+// within a few cache lines instead of scattering over the whole buffer.
+void ObjLoader::reorder_points() {
+    int n = (int) points.size();
+
+    std::vector<int> offsets, adjacent;
+    build_adjacency(offsets, adjacent);
+
+    auto degree = [&offsets](int p) { return offsets[p + 1] - offsets[p]; };
+
+    std::vector<int> order;
+    order.reserve(n);
+    std::vector<bool> visited(n, false);
+
+    // breadth first search from start, visiting neighbours by increasing degree;
+    // returns the last point reached
+    auto bfs = [&](int start, std::vector<int> &out) {
+        size_t first = out.size();
+        visited[start] = true;
+        out.push_back(start);
+        for (size_t head = first; head < out.size(); ++head) {
+            int p = out[head];
+            size_t begin = out.size();
+            for (int i = offsets[p]; i < offsets[p + 1]; ++i) {
+                int q = adjacent[i];
+                if (!visited[q]) {
+                    visited[q] = true;
+                    out.push_back(q);
+                }
+            }
+            std::stable_sort(out.begin() + begin, out.end(),
+                             [&degree](int a, int b) { return degree(a) < degree(b); });
         }
+        return out.back();
+    };
+
+    std::vector<int> component;
+    for (int seed = 0; seed < n; ++seed) {
+        if (visited[seed]) {
+            continue;
+        }
+
+        // start from the far end of the component (pseudo-peripheral point)
+        component.clear();
+        int start = bfs(seed, component);
+        for (int p : component) {
+            visited[p] = false;
+        }
+
+        bfs(start, order);
+    }
+
+    std::reverse(order.begin(), order.end());
+
+    std::vector<cl_int> newIndex(n);
+    for (int i = 0; i < n; ++i) {
+        newIndex[order[i]] = i;
+    }
+
+    // files that are already well ordered (e.g. regular grids) are kept as they are
+    long long spanBefore = 0, spanAfter = 0;
+    for (const auto &e : edges) {
+        spanBefore += std::abs(e.s[0] - e.s[1]);
+        spanAfter += std::abs(newIndex[e.s[0]] - newIndex[e.s[1]]);
+    }
+    if (spanAfter >= spanBefore) {
+        return;
+    }
+
+    std::vector<cl_float4> newPoints(n);
+    std::vector<cl_int> newOriginal(n);
+    for (int i = 0; i < n; ++i) {
+        newPoints[i] = points[order[i]];
+        newOriginal[i] = originalIndex[order[i]];
+    }
+    points.swap(newPoints);
+    originalIndex.swap(newOriginal);
+
+    for (auto &e : edges) {
+        e.s[0] = newIndex[e.s[0]];
+        e.s[1] = newIndex[e.s[1]];
+    }
 
+    for (auto &f : faces) {
+        f.s[0] = newIndex[f.s[0]];
+        f.s[1] = newIndex[f.s[1]];
+        f.s[2] = newIndex[f.s[2]];
+    }
+}
+
+// Reference parser: one std::stringstream per line.
+void ObjLoader::parse_stream(std::istream &f) {
+    std::string line;
+    while (std::getline(f, line)) {
         if (!line.empty()) {
             std::stringstream ss(line);
             std::string type;
@@ -61,16 +203,272 @@ ObjLoader::ObjLoader(std::string filename) {
             }
         }
     }
-    std::cout << "Loaded " <<
-            points.size() << " points, " <<
-            edges.size() << " edges and " <<
-            faces.size() << " faces " <<
-            "from " << filename << std::endl;
+}
 
-    add_faces_as_edges();
-    //connect_neighbors();
-    connect_opposites();
-    //connect_neighbors(0.001, 0.3);
+// everything parsed from one chunk of a mapped file
+struct ObjChunk {
+    std::vector<cl_float4> points;
+    std::vector<cl_float4> normals;
+    std::vector<cl_int2> edges;
+    std::vector<cl_int4> faces;
+    std::string messages;
+};
+
+static inline bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static inline const char *skip_blank(const char *p, const char *end) {
+    while (p < end && is_blank(*p)) {
+        ++p;
+    }
+    return p;
+}
+
+static inline const char *token_end(const char *p, const char *end) {
+    while (p < end && !is_blank(*p)) {
+        ++p;
+    }
+    return p;
+}
+
+// Exact powers of ten. For a mantissa below 2^24 both operands are exact floats,
+// so a single multiplication or division is correctly rounded and gives the same
+// result as strtof (Clinger's fast path).
+static const float powersOfTen[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+
+static const char *parse_float(const char *p, const char *end, float &out) {
+    p = skip_blank(p, end);
+    const char *tokenEnd = token_end(p, end);
+
+    const char *c = p;
+    bool negative = false;
+    if (c < tokenEnd && (*c == '-' || *c == '+')) {
+        negative = *c == '-';
+        ++c;
+    }
+
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool any = false;
+
+    while (c < tokenEnd && *c >= '0' && *c <= '9') {
+        if (mantissa || *c != '0') {
+            ++digits;
+        }
+        mantissa = mantissa * 10 + (*c - '0');
+        any = true;
+        ++c;
+    }
+    if (c < tokenEnd && *c == '.') {
+        ++c;
+        while (c < tokenEnd && *c >= '0' && *c <= '9') {
+            if (mantissa || *c != '0') {
+                ++digits;
+            }
+            mantissa = mantissa * 10 + (*c - '0');
+            --exponent;
+            any = true;
+            ++c;
+        }
+    }
+    if (any && c < tokenEnd && (*c == 'e' || *c == 'E')) {
+        const char *e = c + 1;
+        bool negativeExp = false;
+        if (e < tokenEnd && (*e == '-' || *e == '+')) {
+            negativeExp = *e == '-';
+            ++e;
+        }
+        int value = 0;
+        bool expDigits = false;
+        while (e < tokenEnd && *e >= '0' && *e <= '9' && value < 10000) {
+            value = value * 10 + (*e - '0');
+            expDigits = true;
+            ++e;
+        }
+        if (expDigits) {
+            exponent += negativeExp ? -value : value;
+            c = e;
+        }
+    }
+
+    if (any && c == tokenEnd && digits <= 18 && mantissa < (1 << 24) && exponent >= -10 && exponent <= 10) {
+        float value = (float) mantissa;
+        value = exponent < 0 ? value / powersOfTen[-exponent] : value * powersOfTen[exponent];
+        out = negative ? -value : value;
+        return tokenEnd;
+    }
+
+    // anything unusual (long mantissas, nan, inf, hex...) goes through the C library
+    char buffer[64];
+    size_t len = std::min((size_t) (tokenEnd - p), sizeof(buffer) - 1);
+    memcpy(buffer, p, len);
+    buffer[len] = 0;
+    out = strtof(buffer, NULL);
+    return tokenEnd;
+}
+
+// reads an index, ignoring any /texture/normal part of the token
+static const char *parse_int(const char *p, const char *end, int &out) {
+    p = skip_blank(p, end);
+    const char *tokenEnd = token_end(p, end);
+
+    bool negative = false;
+    if (p < tokenEnd && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        ++p;
+    }
+    int value = 0;
+    while (p < tokenEnd && *p >= '0' && *p <= '9') {
+        value = value * 10 + (*p - '0');
+        ++p;
+    }
+    out = negative ? -value : value;
+    return tokenEnd;
+}
+
+static inline bool token_is(const char *begin, const char *end, const char *type) {
+    size_t len = strlen(type);
+    return (size_t) (end - begin) == len && !memcmp(begin, type, len);
+}
+
+static void parse_chunk(const char *begin, const char *end, ObjChunk &chunk) {
+    // count the lines of every type first, so nothing is reallocated while parsing
+    size_t pointCount = 0, normalCount = 0, edgeCount = 0, faceCount = 0;
+    for (const char *p = begin; p < end; ) {
+        const char *eol = (const char *) memchr(p, '\n', end - p);
+        if (!eol) {
+            eol = end;
+        }
+        const char *t = skip_blank(p, eol);
+        if (eol - t >= 2 && is_blank(t[1])) {
+            pointCount += t[0] == 'v';
+            edgeCount += t[0] == 'l';
+            faceCount += t[0] == 'f';
+        } else if (eol - t >= 3 && t[0] == 'v' && t[1] == 'n' && is_blank(t[2])) {
+            ++normalCount;
+        }
+        p = eol < end ? eol + 1 : end;
+    }
+    chunk.points.reserve(pointCount);
+    chunk.normals.reserve(normalCount);
+    chunk.edges.reserve(edgeCount);
+    chunk.faces.reserve(faceCount);
+
+    for (const char *p = begin; p < end; ) {
+        const char *eol = (const char *) memchr(p, '\n', end - p);
+        if (!eol) {
+            eol = end;
+        }
+        const char *line = p;
+        p = eol < end ? eol + 1 : end;
+
+        if (line == eol) {
+            continue;
+        }
+
+        const char *type = skip_blank(line, eol);
+        const char *typeEnd = token_end(type, eol);
+
+        if (token_is(type, typeEnd, "#")) {
+            continue;
+        } else if (token_is(type, typeEnd, "v") || token_is(type, typeEnd, "vn")) {
+            cl_float4 v;
+            const char *c = parse_float(typeEnd, eol, v.s[0]);
+            c = parse_float(c, eol, v.s[1]);
+            parse_float(c, eol, v.s[2]);
+            v.s[3] = 0;
+            if (typeEnd - type == 1) {
+                chunk.points.push_back(v);
+            } else {
+                chunk.normals.push_back(v);
+            }
+        } else if (token_is(type, typeEnd, "l")) {
+            int a, b;
+            parse_int(parse_int(typeEnd, eol, a), eol, b);
+            cl_int2 edge;
+            edge.s[0] = a - 1;
+            edge.s[1] = b - 1;
+            chunk.edges.push_back(edge);
+        } else if (token_is(type, typeEnd, "f")) {
+            int a, b, c;
+            parse_int(parse_int(parse_int(typeEnd, eol, a), eol, b), eol, c);
+            cl_int4 face;
+            face.s[0] = a - 1;
+            face.s[1] = b - 1;
+            face.s[2] = c - 1;
+            face.s[3] = 0;
+            chunk.faces.push_back(face);
+        } else if (token_is(type, typeEnd, "s")) {
+            // nothing...
+        } else {
+            chunk.messages += "Unknown line type: '" + std::string(type, typeEnd) + "'";
+        }
+    }
+}
+
+// Fast parser: parses the memory mapped file in place, splitting files of a
+// few megabytes into line aligned chunks that are parsed on separate threads.
+bool ObjLoader::parse_file(const std::string &filename, unsigned threads) {
+    MappedFile file(filename);
+    if (!file.valid()) {
+        return false;
+    }
+
+    const char *begin = file.data();
+    const char *end = begin + file.size();
+
+    if (threads == 0) {
+        const size_t chunkSize = 1 << 20;
+        threads = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()),
+                                   file.size() < 4 * chunkSize ? 1 : file.size() / chunkSize);
+    }
+
+    std::vector<const char *> splits;
+    splits.push_back(begin);
+    for (unsigned t = 1; t < threads; ++t) {
+        const char *split = std::max(splits.back(), begin + file.size() * t / threads);
+        const char *eol = (const char *) memchr(split, '\n', end - split);
+        splits.push_back(eol ? eol + 1 : end);
+    }
+    splits.push_back(end);
+
+    std::vector<ObjChunk> chunks(threads);
+    if (threads == 1) {
+        parse_chunk(begin, end, chunks[0]);
+    } else {
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < threads; ++t) {
+            workers.emplace_back(parse_chunk, splits[t], splits[t + 1], std::ref(chunks[t]));
+        }
+        for (auto &w : workers) {
+            w.join();
+        }
+    }
+
+    size_t pointCount = points.size(), normalCount = normals.size();
+    size_t edgeCount = edges.size(), faceCount = faces.size();
+    for (const auto &c : chunks) {
+        pointCount += c.points.size();
+        normalCount += c.normals.size();
+        edgeCount += c.edges.size();
+        faceCount += c.faces.size();
+    }
+    points.reserve(pointCount);
+    normals.reserve(normalCount);
+    edges.reserve(edgeCount);
+    faces.reserve(faceCount);
+
+    for (const auto &c : chunks) {
+        points.insert(points.end(), c.points.begin(), c.points.end());
+        normals.insert(normals.end(), c.normals.begin(), c.normals.end());
+        edges.insert(edges.end(), c.edges.begin(), c.edges.end());
+        faces.insert(faces.end(), c.faces.begin(), c.faces.end());
+        std::cerr << c.messages;
+    }
+
+    return true;
 }
 
 void ObjLoader::add_faces_as_edges() {
@@ -98,15 +496,47 @@ void ObjLoader::connect_opposites() {
         return ((point == face.s[0]) || (point == face.s[1]) || (point == face.s[2]));
     };
 
-    auto is_side = [](const cl_int4 &face, const cl_int2 &edge) {
-        return ((edge.s[0] == face.s[0]) || (edge.s[0] == face.s[1]) || (edge.s[0] == face.s[2]))
-            && ((edge.s[1] == face.s[0]) || (edge.s[1] == face.s[1]) || (edge.s[1] == face.s[2]));
+    auto edge_key = [](cl_int a, cl_int b) {
+        if (a > b) {
+            std::swap(a, b);
+        }
+        return ((uint64_t) (uint32_t) a << 32) | (uint32_t) b;
     };
 
+    // the first two faces on every edge (in face order) and the number of faces on it,
+    // built in one pass so every lookup below is O(1)
+    struct EdgeFaces {
+        int count;
+        int face[2];
+    };
+    std::unordered_map<uint64_t, EdgeFaces> edgeFaces;
+    edgeFaces.reserve(faces.size() * 3 / 2 + 1);
+
+    for (size_t i = 0; i < faces.size(); ++i) {
+        const auto &f = faces[i];
+        for (int k = 0; k < 3; ++k) {
+            auto key = edge_key(f.s[k], f.s[(k + 1) % 3]);
+            auto it = edgeFaces.find(key);
+            if (it == edgeFaces.end()) {
+                EdgeFaces ef;
+                ef.count = 1;
+                ef.face[0] = (int) i;
+                ef.face[1] = -1;
+                edgeFaces.emplace(key, ef);
+            } else {
+                if (it->second.count == 1) {
+                    it->second.face[1] = (int) i;
+                }
+                ++it->second.count;
+            }
+        }
+    }
+
 
     for (size_t i = 0; i < edges.size(); ++i) {
         auto &e = edges[i];
-        long sided = std::count_if(faces.begin(), faces.end(), [&e,&is_side](cl_int4 &f){ return  is_side(f, e); });
+        auto it = edgeFaces.find(edge_key(e.s[0], e.s[1]));
+        long sided = (it == edgeFaces.end()) ? 0 : it->second.count;
         if (sided != 2)
             std::cout << "Edge " << i << " (" << points[e.s[0]].s[0] << "," << points[e.s[0]].s[1] << "," << points[e.s[0]].s[2] << " - " <<
                     points[e.s[1]].s[0] << "," << points[e.s[1]].s[1] << "," << points[e.s[1]].s[2] <<
@@ -114,38 +544,19 @@ void ObjLoader::connect_opposites() {
     }
 
 
-
-    auto &facesvar = faces;
-
-    auto get_opposite_face = [&facesvar,&is_corner,&is_side](const cl_int4 &face, int corner) {
-        cl_int2 e;
-        e.s[0] = 0;
-        e.s[1] = 0;
-        switch (corner) {
-            case 0:
-                e.s[0] = face.s[1];
-                e.s[1] = face.s[2];
-                break;
-            case 1:
-                e.s[0] = face.s[0];
-                e.s[1] = face.s[2];
-                break;
-            case 2:
-                e.s[0] = face.s[0];
-                e.s[1] = face.s[1];
-                break;
-            default:
-                std::cerr << "lolwut" << std::endl;
-                break;
-        }
-
-        for (auto &f : facesvar) {
-            if (is_side(f, e) && !is_corner(f, face.s[corner])) {
-                return f;
+    // the face across the side opposite to the given corner, or -1 on an open boundary
+    auto get_opposite_face = [this, &edgeFaces, &edge_key, &is_corner](const cl_int4 &face, int corner) {
+        auto it = edgeFaces.find(edge_key(face.s[(corner + 1) % 3], face.s[(corner + 2) % 3]));
+        if (it != edgeFaces.end()) {
+            for (int k = 0; k < std::min(it->second.count, 2); ++k) {
+                int other = it->second.face[k];
+                if (!is_corner(faces[other], face.s[corner])) {
+                    return other;
+                }
             }
         }
         std::cout << "FAIL\n";
-        return facesvar[0];
+        return -1;
     };
 
     auto get_opposite_corner = [&is_corner](const cl_int4 &of, const cl_int4 &to) {
@@ -159,96 +570,202 @@ void ObjLoader::connect_opposites() {
         return 0;
     };
 
-    for (const auto &f : faces) {
-        cl_int2 edge;
+    size_t faceCount = faces.size();
+    edges.reserve(edges.size() + faceCount * 3);
 
-        auto opp = get_opposite_face(f, 0);
-        edge.s[0] = f.s[0];
-        edge.s[1] = get_opposite_corner(f, opp);
-        edges.push_back(edge);
+    for (size_t i = 0; i < faceCount; ++i) {
+        const auto f = faces[i];
 
-        opp = get_opposite_face(f, 1);
-        edge.s[0] = f.s[1];
-        edge.s[1] = get_opposite_corner(f, opp);
-        edges.push_back(edge);
+        for (int corner = 0; corner < 3; ++corner) {
+            int opp = get_opposite_face(f, corner);
+            if (opp < 0) {
+                continue;
+            }
 
-        opp = get_opposite_face(f, 2);
-        edge.s[0] = f.s[2];
-        edge.s[1] = get_opposite_corner(f, opp);
-        edges.push_back(edge);
+            cl_int2 edge;
+            edge.s[0] = f.s[corner];
+            edge.s[1] = get_opposite_corner(f, faces[opp]);
+            edges.push_back(edge);
+        }
     }
 
 }
 
+// Connects every point to all points at most two springs away. The result,
+// including the springs that were already there, is deduplicated: every
+// spring is stored once as (lower, higher) index and the list is sorted.
 void ObjLoader::connect_neighbors() {
-    std::vector<cl_int2> new_edges;
-
-    for (int p = 0; p < (int)points.size(); ++p) {
-        for (int e1 = 0; e1 < (int)edges.size(); ++e1) {
-            if (edges[e1].s[0] == p || edges[e1].s[1] == p) {
-                for (int e2 = 0; e2 < (int)edges.size(); ++e2) {
+    std::vector<int> offsets, adjacent;
+    build_adjacency(offsets, adjacent);
 
-                    if (edges[e2].s[0] == edges[e1].s[1]) {
-                        cl_int2 new_edge;
-                        new_edge.s[0] = p;
-                        new_edge.s[1] = edges[e2].s[1];
-
-                        new_edges.push_back(new_edge);
-                    }
+    int n = (int) points.size();
 
-                    if (edges[e2].s[1] == edges[e1].s[1]) {
+    std::vector<cl_int2> new_edges;
+    new_edges.reserve(edges.size() * 4);
+
+    // marker[r] == p if r has already been collected for p
+    std::vector<int> marker(n, -1);
+
+    for (int p = 0; p < n; ++p) {
+        marker[p] = p;
+        for (int i = offsets[p]; i < offsets[p + 1]; ++i) {
+            int q = adjacent[i];
+            for (int j = offsets[q]; j < offsets[q + 1]; ++j) {
+                int r = adjacent[j];
+                if (marker[r] != p) {
+                    marker[r] = p;
+                    if (r > p) {
                         cl_int2 new_edge;
                         new_edge.s[0] = p;
-                        new_edge.s[1] = edges[e2].s[0];
-
+                        new_edge.s[1] = r;
                         new_edges.push_back(new_edge);
                     }
-
                 }
             }
         }
     }
 
-    for (const auto &e : new_edges) {
-        edges.push_back(e);
+    for (const auto &e : edges) {
+        if (e.s[0] == e.s[1]) {
+            continue;
+        }
+        cl_int2 canonical;
+        canonical.s[0] = std::min(e.s[0], e.s[1]);
+        canonical.s[1] = std::max(e.s[0], e.s[1]);
+        new_edges.push_back(canonical);
     }
 
-    std::unique(edges.begin(), edges.end(), [](const cl_int2 &a, const cl_int2 &b) {
-        return ((a.s[0] == b.s[0]) && a.s[1] == b.s[1])
-            || ((a.s[0] == b.s[1]) && a.s[1] == b.s[0]);
-    });
+    auto less = [](const cl_int2 &a, const cl_int2 &b) {
+        return (a.s[0] < b.s[0]) || ((a.s[0] == b.s[0]) && (a.s[1] < b.s[1]));
+    };
+    auto equal = [](const cl_int2 &a, const cl_int2 &b) {
+        return (a.s[0] == b.s[0]) && (a.s[1] == b.s[1]);
+    };
 
-    std::remove_if(edges.begin(), edges.end(), [](const cl_int2 &e){
-        return e.s[0] == e.s[1];
-    });
+    std::sort(new_edges.begin(), new_edges.end(), less);
+    new_edges.erase(std::unique(new_edges.begin(), new_edges.end(), equal), new_edges.end());
+
+    std::cout << "Two-ring connection: " << edges.size() << " edges -> " << new_edges.size() << " unique springs." << std::endl;
+
+    edges.swap(new_edges);
 }
 
 void ObjLoader::connect_neighbors(float mindist, float maxdist) {
     float mindistSqr = mindist * mindist;
     float maxdistSqr = maxdist * maxdist;
 
-    int n = 0;
+    size_t count = points.size();
+    if (count == 0 || !(maxdist > 0)) {
+        std::cout << "Added 0 new edges." << std::endl;
+        return;
+    }
 
-    for (size_t i = 0; i < points.size(); ++i) {
-        const auto &p1 = points[i];
-        for (size_t j = i + 1; j < points.size(); ++j) {
-            const auto &p2 = points[j];
+    // uniform grid with maxdist sized cells: every pair closer than maxdist
+    // lies in the same or in adjacent cells
+    float lo[3] = {points[0].s[0], points[0].s[1], points[0].s[2]};
+    for (const auto &p : points) {
+        for (int k = 0; k < 3; ++k) {
+            lo[k] = std::min(lo[k], p.s[k]);
+        }
+    }
 
-            float dx = p1.s[0] - p2.s[0];
-            float dy = p1.s[1] - p2.s[1];
-            float dz = p1.s[2] - p2.s[2];
+    const int64_t cellMax = (1 << 21) - 1;
 
-            float dstSqr = (dx * dx + dy*dy + dz*dz);
+    auto cell_of = [&lo, maxdist, cellMax](const cl_float4 &p, int k) {
+        return std::min((int64_t) ((p.s[k] - lo[k]) / maxdist), cellMax);
+    };
 
-            if ((dstSqr >= mindistSqr) && (dstSqr <= maxdistSqr)) {
-                cl_int2 edge;
-                edge.s[0] = (int)i;
-                edge.s[1] = (int)j;
-                edges.push_back(edge);
+    auto cell_key = [](int64_t x, int64_t y, int64_t z) {
+        return (uint64_t) ((x << 42) | (y << 21) | z);
+    };
 
-                ++n;
+    std::vector<std::pair<uint64_t, int>> sorted(count);
+    for (size_t i = 0; i < count; ++i) {
+        const auto &p = points[i];
+        sorted[i] = std::make_pair(cell_key(cell_of(p, 0), cell_of(p, 1), cell_of(p, 2)), (int) i);
+    }
+    std::sort(sorted.begin(), sorted.end());
+
+    // [first, last) range of every occupied cell in sorted
+    std::unordered_map<uint64_t, std::pair<int, int>> cells;
+    cells.reserve(count);
+    for (size_t i = 0; i < count; ) {
+        size_t j = i;
+        while (j < count && sorted[j].first == sorted[i].first) {
+            ++j;
+        }
+        cells.emplace(sorted[i].first, std::make_pair((int) i, (int) j));
+        i = j;
+    }
+
+    // every point collects its partners with a higher index and sorts them, so the
+    // edges come out in the same order as the all-pairs loop produced them
+    auto connect_range = [&](size_t begin, size_t end, std::vector<cl_int2> &out) {
+        std::vector<int> partners;
+        for (size_t i = begin; i < end; ++i) {
+            const auto &p1 = points[i];
+            int64_t cx = cell_of(p1, 0), cy = cell_of(p1, 1), cz = cell_of(p1, 2);
+
+            partners.clear();
+            for (int64_t x = std::max<int64_t>(cx - 1, 0); x <= std::min(cx + 1, cellMax); ++x) {
+                for (int64_t y = std::max<int64_t>(cy - 1, 0); y <= std::min(cy + 1, cellMax); ++y) {
+                    for (int64_t z = std::max<int64_t>(cz - 1, 0); z <= std::min(cz + 1, cellMax); ++z) {
+                        auto it = cells.find(cell_key(x, y, z));
+                        if (it == cells.end()) {
+                            continue;
+                        }
+
+                        for (int c = it->second.first; c < it->second.second; ++c) {
+                            size_t j = sorted[c].second;
+                            if (j <= i) {
+                                continue;
+                            }
+                            const auto &p2 = points[j];
+
+                            float dx = p1.s[0] - p2.s[0];
+                            float dy = p1.s[1] - p2.s[1];
+                            float dz = p1.s[2] - p2.s[2];
+
+                            float dstSqr = (dx * dx + dy*dy + dz*dz);
+
+                            if ((dstSqr >= mindistSqr) && (dstSqr <= maxdistSqr)) {
+                                partners.push_back((int) j);
+                            }
+                        }
+                    }
+                }
+            }
+
+            std::sort(partners.begin(), partners.end());
+            for (int j : partners) {
+                cl_int2 edge;
+                edge.s[0] = (int) i;
+                edge.s[1] = j;
+                out.push_back(edge);
             }
         }
+    };
+
+    size_t threadCount = std::max(1u, std::thread::hardware_concurrency());
+    threadCount = std::min(threadCount, (count + 1023) / 1024);
+
+    std::vector<std::vector<cl_int2>> found(threadCount);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < threadCount; ++t) {
+        threads.emplace_back(connect_range, count * t / threadCount, count * (t + 1) / threadCount,
+                             std::ref(found[t]));
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    size_t n = 0;
+    for (const auto &f : found) {
+        n += f.size();
+    }
+    edges.reserve(edges.size() + n);
+    for (const auto &f : found) {
+        edges.insert(edges.end(), f.begin(), f.end());
     }
 
     std::cout << "Added " << n << " new edges." << std::endl;
@@ -12,16 +12,38 @@
 
 class ObjLoader {
 public:
+    // loads the file and builds all springs
     ObjLoader(std::string filename);
+
+    // empty, to be filled by parse_file() or parse_stream() alone
+    ObjLoader() {}
+
     std::vector<cl_float4> points;
     std::vector<cl_float4> normals;
     std::vector<cl_int2> edges;
     std::vector<cl_int4> faces;
 
+    // file index of every point after reorder_points(), identity otherwise
+    std::vector<cl_int> originalIndex;
+
+    // whether the constructor renumbers points for memory locality
+    static bool reorderPoints;
+
+    // memory mapped fast path, threads == 0 picks a count from the file size;
+    // returns false if the file cannot be mapped
+    bool parse_file(const std::string &filename, unsigned threads = 0);
+    // line by line reference parser
+    void parse_stream(std::istream &in);
+
     void connect_neighbors(float mindist, float maxdist);
     void connect_neighbors();
     void connect_opposites();
     void add_faces_as_edges();
+    void reorder_points();
+
+private:
+    // undirected spring graph in compressed sparse row form
+    void build_adjacency(std::vector<int> &offsets, std::vector<int> &adjacent) const;
 };
 
 
@@ -0,0 +1,176 @@
+#include "Profiler.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+
+Profiler *Profiler::instance = 0;
+
+Profiler::Profiler(const char *path) : origin{std::chrono::steady_clock::now()} {
+    if (!path || !*path) {
+        return;
+    }
+
+    if (instance) {
+        throw "Only one instance plz!";
+    }
+
+    this->path = path;
+    instance = this;
+}
+
+Profiler::~Profiler() {
+    if (instance == this) {
+        write();
+        instance = 0;
+    }
+}
+
+uint64_t Profiler::now() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+}
+
+void Profiler::record(const char *name, cl_event ev, uint64_t hostEnqueue) {
+    std::lock_guard<std::mutex> guard(lock);
+    pending.push_back({name, ev, hostEnqueue});
+}
+
+void Profiler::hostSpan(const char *name, uint64_t begin, uint64_t end) {
+    std::lock_guard<std::mutex> guard(lock);
+    host.push_back({name, begin, end});
+}
+
+void Profiler::collect() {
+    std::lock_guard<std::mutex> guard(lock);
+    collectLocked(false);
+}
+
+void Profiler::collectLocked(bool wait) {
+    size_t kept = 0;
+    for (auto &c : pending) {
+        cl_int status = CL_COMPLETE;
+        if (wait) {
+            clWaitForEvents(1, &c.ev);
+        } else {
+            clGetEventInfo(c.ev, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, NULL);
+            if (status > CL_COMPLETE) {
+                pending[kept++] = c;
+                continue;
+            }
+        }
+
+        DeviceSpan s{c.name, 0, 0, 0, 0, c.hostEnqueue};
+        bool ok = status == CL_COMPLETE &&
+                  clGetEventProfilingInfo(c.ev, CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &s.queued, NULL) == CL_SUCCESS &&
+                  clGetEventProfilingInfo(c.ev, CL_PROFILING_COMMAND_SUBMIT, sizeof(cl_ulong), &s.submit, NULL) == CL_SUCCESS &&
+                  clGetEventProfilingInfo(c.ev, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &s.start, NULL) == CL_SUCCESS &&
+                  clGetEventProfilingInfo(c.ev, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &s.end, NULL) == CL_SUCCESS;
+        if (ok) {
+            device.push_back(s);
+        }
+        clReleaseEvent(c.ev);
+    }
+    pending.resize(kept);
+}
+
+static void writeEscaped(std::ostream &out, const std::string &s) {
+    out << '"';
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out << '\\';
+        }
+        out << c;
+    }
+    out << '"';
+}
+
+void Profiler::write() {
+    std::lock_guard<std::mutex> guard(lock);
+    if (written) {
+        return;
+    }
+    written = true;
+
+    collectLocked(true);
+
+    // The device clock has its own epoch. A command is queued no earlier than
+    // the host started enqueueing it, so the largest hostEnqueue - queued is
+    // the tightest estimate of the device -> host offset.
+    bool haveOffset = false;
+    int64_t offset = 0;
+    for (const auto &s : device) {
+        int64_t o = (int64_t) s.hostEnqueue - (int64_t) s.queued;
+        if (!haveOffset || o > offset) {
+            offset = o;
+            haveOffset = true;
+        }
+    }
+
+    std::ofstream out(path);
+    if (!out) {
+        std::cerr << "cannot write trace " << path << std::endl;
+        return;
+    }
+
+    // trace-event timestamps are in microseconds
+    auto us = [](int64_t ns) { return ns / 1000.0; };
+
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+        << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"host\"}},\n"
+        << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"device queue\"}}";
+
+    for (const auto &h : host) {
+        out << ",\n{\"name\":";
+        writeEscaped(out, h.name);
+        out << ",\"cat\":\"host\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":" << us(h.begin)
+            << ",\"dur\":" << us(h.end - h.begin) << "}";
+    }
+
+    for (const auto &s : device) {
+        out << ",\n{\"name\":";
+        writeEscaped(out, s.name);
+        out << ",\"cat\":\"device\",\"ph\":\"X\",\"pid\":1,\"tid\":2,\"ts\":" << us(s.start + offset)
+            << ",\"dur\":" << us(s.end - s.start)
+            << ",\"args\":{\"queued_us\":" << us(s.queued + offset)
+            << ",\"submit_us\":" << us(s.submit + offset)
+            << ",\"wait_us\":" << us(s.start - s.queued) << "}}";
+    }
+    out << "\n]}\n";
+
+    // per command totals, largest first
+    struct Total {
+        size_t count = 0;
+        cl_ulong busy = 0, wait = 0;
+    };
+    std::map<std::string, Total> totals;
+    cl_ulong busy = 0;
+    for (const auto &s : device) {
+        Total &t = totals[s.name];
+        ++t.count;
+        t.busy += s.end - s.start;
+        t.wait += s.start - s.queued;
+        busy += s.end - s.start;
+    }
+
+    std::vector<std::pair<std::string, Total>> sorted(totals.begin(), totals.end());
+    std::sort(sorted.begin(), sorted.end(), [](const std::pair<std::string, Total> &a,
+                                                const std::pair<std::string, Total> &b) {
+        return a.second.busy > b.second.busy;
+    });
+
+    std::cerr << "Trace written to " << path << " (" << device.size() << " device commands, "
+              << host.size() << " host spans)\n" << std::fixed << std::setprecision(3);
+    for (const auto &e : sorted) {
+        const Total &t = e.second;
+        std::cerr << "  " << std::setw(20) << std::left << e.first << std::right
+                  << std::setw(8) << t.count << " x "
+                  << std::setw(10) << t.busy / 1e3 / t.count << " us = "
+                  << std::setw(10) << t.busy / 1e6 << " ms ("
+                  << std::setw(5) << std::setprecision(1) << (busy ? 100.0 * t.busy / busy : 0.0) << "%)"
+                  << std::setprecision(3) << ", queued -> start " << t.wait / 1e3 / t.count << " us avg\n";
+    }
+    std::cerr.flush();
+}
@@ -0,0 +1,93 @@
+#ifndef GPGPU_HF_PROFILER_H
+#define GPGPU_HF_PROFILER_H
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <CL/cl.h>
+
+// Collects device command timestamps (from a profiling enabled queue) and
+// host spans, and writes them as a Chrome trace-event JSON timeline that
+// chrome://tracing or Perfetto can open.
+//
+// Construct it before the CLWrapper so the queue gets CL_QUEUE_PROFILING_ENABLE.
+class Profiler {
+public:
+    // a null or empty path leaves profiling disabled and instance unset
+    Profiler(const char *path);
+
+    Profiler(const Profiler &) = delete;
+    Profiler &operator=(const Profiler &) = delete;
+
+    // writes the trace if it was not written yet
+    ~Profiler();
+
+    static Profiler *instance;
+
+    // host time in ns since the profiler was created
+    uint64_t now() const;
+
+    // takes over one reference of ev; hostEnqueue is now() just before the enqueue call
+    void record(const char *name, cl_event ev, uint64_t hostEnqueue);
+
+    void hostSpan(const char *name, uint64_t begin, uint64_t end);
+
+    // reads the timestamps of completed commands and releases their events;
+    // call it once in a while (e.g. every frame) to keep the pending list short
+    void collect();
+
+    // waits for all pending commands, writes the trace and prints per-command totals
+    void write();
+
+private:
+    struct Command {
+        std::string name;
+        cl_event ev;
+        uint64_t hostEnqueue;
+    };
+
+    struct DeviceSpan {
+        std::string name;
+        cl_ulong queued, submit, start, end;
+        uint64_t hostEnqueue;
+    };
+
+    struct HostSpan {
+        std::string name;
+        uint64_t begin, end;
+    };
+
+    std::string path;
+    std::chrono::steady_clock::time_point origin;
+    std::mutex lock;
+    std::vector<Command> pending;
+    std::vector<DeviceSpan> device;
+    std::vector<HostSpan> host;
+    bool written = false;
+
+    void collectLocked(bool wait);
+};
+
+// Records the lifetime of the scope as a host span, if profiling is enabled.
+class ProfileScope {
+    const char *name;
+    uint64_t begin;
+
+public:
+    ProfileScope(const char *name) : name{name}, begin{Profiler::instance ? Profiler::instance->now() : 0} {}
+
+    ProfileScope(const ProfileScope &) = delete;
+    ProfileScope &operator=(const ProfileScope &) = delete;
+
+    ~ProfileScope() {
+        if (Profiler::instance) {
+            Profiler::instance->hostSpan(name, begin, Profiler::instance->now());
+        }
+    }
+};
+
+
+#endif //GPGPU_HF_PROFILER_H
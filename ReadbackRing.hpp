@@ -0,0 +1,154 @@
+#ifndef GPGPU_HF_READBACKRING_H
+#define GPGPU_HF_READBACKRING_H
+
+#include <CL/cl.h>
+#include "clwrapper.hpp"
+#include "CLBuffer.hpp"
+#include "CLKernel.hpp"
+#include "Profiler.hpp"
+
+#include <cstdint>
+#include <initializer_list>
+#include <vector>
+
+// Non-blocking copies of device buffers into pinned host memory, one per
+// frame, kept in CLWrapper::readbackLatency + 1 slots. The host draws the
+// newest copy that is done while the device already simulates the next
+// frames, but never one more than readbackLatency frames old: if none of
+// those is done, latest() waits for the oldest of them.
+//
+// With a latency of 0 there is a single slot and latest() waits for the copy
+// of the current frame, like mapping the buffer did.
+template<typename T>
+class ReadbackRing {
+    struct Slot {
+        // allocated by the driver so it can be pinned, mapped once for good
+        cl_mem staging;
+        T *host;
+        // the copy, null once it is known to be done
+        cl_event ready = 0;
+    };
+
+    std::vector<Slot> slots;
+    size_t length;
+    size_t sources;
+    int64_t frame = -1;
+
+    size_t bytes() const {
+        return (length ? length : 1) * sources * sizeof(T);
+    }
+
+    static bool done(Slot &slot) {
+        if (!slot.ready) {
+            return true;
+        }
+
+        cl_int status;
+        clGetEventInfo(slot.ready, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, NULL);
+        if (status != CL_COMPLETE) {
+            return false;
+        }
+
+        clReleaseEvent(slot.ready);
+        slot.ready = 0;
+        return true;
+    }
+
+    static void wait(Slot &slot) {
+        if (slot.ready) {
+            ProfileScope scope("readback wait");
+            clWaitForEvents(1, &slot.ready);
+            clReleaseEvent(slot.ready);
+            slot.ready = 0;
+        }
+    }
+
+public:
+    // sources is the number of buffers enqueue() copies together
+    ReadbackRing(size_t length, size_t sources = 1) :
+            slots(CLWrapper::readbackLatency + 1), length{length}, sources{sources} {
+        for (auto &slot : slots) {
+            slot.staging = clCreateBuffer(CLWrapper::instance->context(), CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                                          bytes(), NULL, NULL);
+            slot.host = (T *) clEnqueueMapBuffer(CLWrapper::instance->cqueue(), slot.staging, CL_TRUE,
+                                                 CL_MAP_READ | CL_MAP_WRITE, 0, bytes(), 0, NULL, NULL, NULL);
+        }
+    }
+
+    ReadbackRing(const ReadbackRing &) = delete;
+    ReadbackRing &operator=(const ReadbackRing &) = delete;
+
+    size_t size() const {
+        return length;
+    }
+
+    // enqueues copying the buffers (as many as the constructor was given), each
+    // of size() elements, after the commands of chain into the next slot
+    void enqueue(std::initializer_list<CLBuffer<T> *> buffers, EventChain &chain) {
+        Slot &slot = slots[++frame % slots.size()];
+        // still being copied if latest() was not called since
+        wait(slot);
+
+        if (!length) {
+            return;
+        }
+
+        Profiler *profiler = Profiler::instance;
+        T *host = slot.host;
+
+        // each copy waits for the previous one, so the last event covers all of them
+        for (auto source : buffers) {
+            uint64_t hostEnqueue = profiler ? profiler->now() : 0;
+            cl_event previous = slot.ready;
+            bool first = !previous;
+
+            clEnqueueReadBuffer(CLWrapper::instance->cqueue(), *source, CL_FALSE, 0, length * sizeof(T), host,
+                                first ? chain.count() : 1, first ? chain.events() : &previous, &slot.ready);
+            if (previous) {
+                clReleaseEvent(previous);
+            }
+            if (profiler) {
+                clRetainEvent(slot.ready);
+                profiler->record("readback", slot.ready, hostEnqueue);
+            }
+            host += length;
+        }
+
+        // the next step must not overwrite the sources before they are copied
+        if (CLWrapper::instance->outOfOrder()) {
+            clRetainEvent(slot.ready);
+            chain.advance(slot.ready);
+        }
+    }
+
+    // the newest finished slot, or null before the first enqueue(); the copy of
+    // the k-th source starts at k * size(), valid until the next enqueue()
+    const T *latest() {
+        if (frame < 0) {
+            return 0;
+        }
+
+        for (int64_t f = frame; f > frame - (int64_t) slots.size() && f >= 0; --f) {
+            Slot &slot = slots[f % slots.size()];
+            if (done(slot)) {
+                return slot.host;
+            }
+        }
+
+        // none is done yet, the oldest is also the one enqueue() writes next
+        Slot &oldest = slots[(frame < (int64_t) slots.size() ? 0 : frame + 1) % slots.size()];
+        wait(oldest);
+        return oldest.host;
+    }
+
+    ~ReadbackRing() {
+        for (auto &slot : slots) {
+            wait(slot);
+            clEnqueueUnmapMemObject(CLWrapper::instance->cqueue(), slot.staging, slot.host, 0, NULL, NULL);
+            clReleaseMemObject(slot.staging);
+        }
+    }
+};
+
+
+#endif //GPGPU_HF_READBACKRING_H
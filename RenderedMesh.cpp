@@ -0,0 +1,30 @@
+#include "RenderedMesh.hpp"
+
+MeshRenderer *MeshRenderer::instance = 0;
+
+RenderedMesh &RenderedMesh::operator=(RenderedMesh &&other) {
+    if (this != &other) {
+        this->~RenderedMesh();
+        id = other.id;
+        other.id = -1;
+    }
+    return *this;
+}
+
+RenderedMesh::~RenderedMesh() {
+    if (id >= 0 && MeshRenderer::instance) {
+        MeshRenderer::instance->removeMesh(id);
+    }
+    id = -1;
+}
+
+void RenderedMesh::submit(const MeshData &mesh, const cl_float4 *positions, const cl_float4 *normals) {
+    if (!MeshRenderer::instance) {
+        return;
+    }
+
+    if (id < 0) {
+        id = MeshRenderer::instance->addMesh(mesh.edges, mesh.faces);
+    }
+    MeshRenderer::instance->submit(id, positions, normals, mesh.points.size());
+}
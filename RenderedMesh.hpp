@@ -0,0 +1,54 @@
+#ifndef GPGPU_HF_RENDEREDMESH_H
+#define GPGPU_HF_RENDEREDMESH_H
+
+#include <cstddef>
+
+#include <CL/cl_platform.h>
+
+#include "MeshData.hpp"
+
+// Where the simulated objects send their vertices to be drawn. Renderer
+// implements it with GL; the objects only see this interface, so they build
+// and run without GL, e.g. in gpgpu_bench, where instance stays null.
+class MeshRenderer {
+public:
+    // the renderer of the running program, if any
+    static MeshRenderer *instance;
+
+    // keeps the indices of a mesh, returns its id
+    virtual int addMesh(const ArrayView<cl_int2> &edges, const ArrayView<cl_int4> &faces) = 0;
+
+    virtual void removeMesh(int id) = 0;
+
+    // copies the vertices of mesh id for this frame; normals may be null if it has no faces
+    virtual void submit(int id, const cl_float4 *positions, const cl_float4 *normals, size_t count) = 0;
+
+    // draws everything submitted since the last flush
+    virtual void flush() = 0;
+
+    virtual ~MeshRenderer() {}
+};
+
+// Registers a mesh with MeshRenderer::instance on first use and removes it
+// again on destruction; a member of every object that renders.
+class RenderedMesh {
+    int id = -1;
+
+public:
+    RenderedMesh() {}
+
+    RenderedMesh(const RenderedMesh &) = delete;
+    RenderedMesh &operator=(const RenderedMesh &) = delete;
+
+    RenderedMesh(RenderedMesh &&other) : id{other.id} { other.id = -1; }
+
+    RenderedMesh &operator=(RenderedMesh &&other);
+
+    ~RenderedMesh();
+
+    // submits the current vertices to MeshRenderer::instance, if there is one
+    void submit(const MeshData &mesh, const cl_float4 *positions, const cl_float4 *normals);
+};
+
+
+#endif //GPGPU_HF_RENDEREDMESH_H
@@ -0,0 +1,241 @@
+#include "Renderer.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+// major * 10 + minor of the current context
+static int glVersion() {
+    const char *version = (const char *) glGetString(GL_VERSION);
+    int major = 0, minor = 0;
+    if (!version || sscanf(version, "%d.%d", &major, &minor) != 2) {
+        return 0;
+    }
+    return major * 10 + minor;
+}
+
+static bool hasExtension(const char *name) {
+    const char *extensions = (const char *) glGetString(GL_EXTENSIONS);
+    if (!extensions) {
+        return false;
+    }
+
+    size_t length = strlen(name);
+    for (const char *p = strstr(extensions, name); p; p = strstr(p + length, name)) {
+        if ((p == extensions || p[-1] == ' ') && (p[length] == ' ' || p[length] == 0)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// the core entry point, or the one of the ARB extension it came from
+template<typename Function>
+static Function resolve(Renderer::GetProcAddress getProcAddress, const char *name, const char *arbName) {
+    void *f = getProcAddress(name);
+    if (!f && arbName) {
+        f = getProcAddress(arbName);
+    }
+    return (Function) f;
+}
+
+Renderer::Renderer(GetProcAddress getProcAddress) {
+    int version = glVersion();
+
+    if (version >= 15 || hasExtension("GL_ARB_vertex_buffer_object")) {
+        genBuffers = resolve<PFNGLGENBUFFERSPROC>(getProcAddress, "glGenBuffers", "glGenBuffersARB");
+        deleteBuffers = resolve<PFNGLDELETEBUFFERSPROC>(getProcAddress, "glDeleteBuffers", "glDeleteBuffersARB");
+        bindBuffer = resolve<PFNGLBINDBUFFERPROC>(getProcAddress, "glBindBuffer", "glBindBufferARB");
+        bufferData = resolve<PFNGLBUFFERDATAPROC>(getProcAddress, "glBufferData", "glBufferDataARB");
+    }
+    buffersSupported = genBuffers && deleteBuffers && bindBuffer && bufferData;
+
+    if (version >= 32 || hasExtension("GL_ARB_draw_elements_base_vertex")) {
+        multiDrawElementsBaseVertex = resolve<PFNGLMULTIDRAWELEMENTSBASEVERTEXPROC>(
+                getProcAddress, "glMultiDrawElementsBaseVertex", 0);
+    }
+
+    if (!buffersSupported) {
+        std::cerr << "Renderer: the GL has no buffer objects, nothing will be drawn" << std::endl;
+    } else {
+        genBuffers(1, &positionVbo);
+        genBuffers(1, &normalVbo);
+        genBuffers(1, &indexVbo);
+    }
+
+    std::cout << "Renderer: " << (const char *) glGetString(GL_RENDERER) << ", "
+            << (multiDrawElementsBaseVertex ? "multi-draw" : "one draw per object") << std::endl;
+
+    instance = this;
+}
+
+Renderer::~Renderer() {
+    if (buffersSupported) {
+        deleteBuffers(1, &positionVbo);
+        deleteBuffers(1, &normalVbo);
+        deleteBuffers(1, &indexVbo);
+    }
+
+    if (instance == this) {
+        instance = 0;
+    }
+}
+
+int Renderer::addMesh(const ArrayView<cl_int2> &edges, const ArrayView<cl_int4> &faces) {
+    size_t id = 0;
+    while (id < meshes.size() && meshes[id].used) {
+        ++id;
+    }
+    if (id == meshes.size()) {
+        meshes.emplace_back();
+    }
+
+    Mesh &mesh = meshes[id];
+    mesh.used = true;
+    mesh.indices.clear();
+    mesh.indices.reserve(edges.size() * 2 + faces.size() * 3);
+
+    for (const auto &e : edges) {
+        mesh.indices.push_back(e.s[0]);
+        mesh.indices.push_back(e.s[1]);
+    }
+    for (const auto &f : faces) {
+        mesh.indices.push_back(f.s[0]);
+        mesh.indices.push_back(f.s[1]);
+        mesh.indices.push_back(f.s[2]);
+    }
+    mesh.edgeIndices = edges.size() * 2;
+    mesh.faceIndices = faces.size() * 3;
+
+    indicesDirty = true;
+    return (int) id;
+}
+
+void Renderer::removeMesh(int id) {
+    Mesh &mesh = meshes[id];
+    mesh.used = false;
+    std::vector<GLuint>().swap(mesh.indices);
+
+    indicesDirty = true;
+}
+
+void Renderer::submit(int id, const cl_float4 *positions, const cl_float4 *normals, size_t count) {
+    Draw draw;
+    draw.mesh = id;
+    draw.baseVertex = (GLint) this->positions.size();
+    draws.push_back(draw);
+
+    this->positions.insert(this->positions.end(), positions, positions + count);
+    if (normals) {
+        this->normals.insert(this->normals.end(), normals, normals + count);
+    } else {
+        this->normals.resize(this->positions.size(), cl_float4{{0, 0, 0, 0}});
+    }
+}
+
+void Renderer::uploadIndices() {
+    std::vector<GLuint> indices;
+    for (auto &mesh : meshes) {
+        if (mesh.used) {
+            mesh.firstIndex = indices.size();
+            indices.insert(indices.end(), mesh.indices.begin(), mesh.indices.end());
+        }
+    }
+
+    bindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexVbo);
+    bufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+
+    indicesDirty = false;
+}
+
+void Renderer::drawElements(GLenum mode, bool faces) {
+    counts.clear();
+    offsets.clear();
+    baseVertices.clear();
+
+    for (const auto &draw : draws) {
+        const Mesh &mesh = meshes[draw.mesh];
+        size_t count = faces ? mesh.faceIndices : mesh.edgeIndices;
+        if (!count) {
+            continue;
+        }
+
+        size_t first = mesh.firstIndex + (faces ? mesh.edgeIndices : 0);
+        counts.push_back((GLsizei) count);
+        offsets.push_back((const void *) (first * sizeof(GLuint)));
+        baseVertices.push_back(draw.baseVertex);
+    }
+
+    if (counts.empty()) {
+        return;
+    }
+
+    if (multiDrawElementsBaseVertex) {
+        multiDrawElementsBaseVertex(mode, counts.data(), GL_UNSIGNED_INT, offsets.data(),
+                                    (GLsizei) counts.size(), baseVertices.data());
+        return;
+    }
+
+    // the indices are per object, so the arrays start at its first vertex instead
+    for (size_t i = 0; i < counts.size(); ++i) {
+        const void *base = (const void *) (baseVertices[i] * sizeof(cl_float4));
+
+        bindBuffer(GL_ARRAY_BUFFER, positionVbo);
+        glVertexPointer(3, GL_FLOAT, sizeof(cl_float4), base);
+        if (faces) {
+            bindBuffer(GL_ARRAY_BUFFER, normalVbo);
+            glNormalPointer(GL_FLOAT, sizeof(cl_float4), base);
+        }
+
+        glDrawElements(mode, counts[i], GL_UNSIGNED_INT, offsets[i]);
+    }
+}
+
+void Renderer::flush() {
+    if (draws.empty() || !buffersSupported) {
+        positions.clear();
+        normals.clear();
+        draws.clear();
+        return;
+    }
+
+    if (indicesDirty) {
+        uploadIndices();
+    }
+
+    // a fresh store every frame, so the driver never waits for the previous draw
+    bindBuffer(GL_ARRAY_BUFFER, normalVbo);
+    bufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(cl_float4), normals.data(), GL_STREAM_DRAW);
+    glNormalPointer(GL_FLOAT, sizeof(cl_float4), 0);
+
+    bindBuffer(GL_ARRAY_BUFFER, positionVbo);
+    bufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(cl_float4), positions.data(), GL_STREAM_DRAW);
+    glVertexPointer(3, GL_FLOAT, sizeof(cl_float4), 0);
+
+    bindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexVbo);
+
+    glEnableClientState(GL_VERTEX_ARRAY);
+
+    glPointSize(3);
+    glColor4f(1, 1, 1, 1);
+    glDrawArrays(GL_POINTS, 0, (GLsizei) positions.size());
+
+    glColor3f(0.8, 0.4, 0.2);
+    drawElements(GL_LINES, false);
+
+    glEnableClientState(GL_NORMAL_ARRAY);
+    glEnable(GL_LIGHTING);
+    glColor3f(0.2, 0.4, 0.8);
+    drawElements(GL_TRIANGLES, true);
+    glDisable(GL_LIGHTING);
+    glDisableClientState(GL_NORMAL_ARRAY);
+
+    glDisableClientState(GL_VERTEX_ARRAY);
+
+    bindBuffer(GL_ARRAY_BUFFER, 0);
+    bindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    positions.clear();
+    normals.clear();
+    draws.clear();
+}
@@ -0,0 +1,93 @@
+#ifndef GPGPU_HF_RENDERER_H
+#define GPGPU_HF_RENDERER_H
+
+#include <vector>
+
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include <CL/cl_platform.h>
+
+#include "MeshData.hpp"
+#include "RenderedMesh.hpp"
+
+// Draws every simulated object from vertex buffer objects. The edge and face
+// indices of each mesh are uploaded once into a shared element buffer; every
+// frame the objects only submit their positions and normals, which go into
+// two streamed buffers with a single upload each. With
+// glMultiDrawElementsBaseVertex (GL 3.2 or ARB_draw_elements_base_vertex) all
+// objects are drawn with one call per primitive type, otherwise with one
+// glDrawElements per object (GL 1.5, e.g. older Mesa software rasterizers).
+//
+// Construct it once the GL context exists; it then becomes
+// MeshRenderer::instance, which the objects draw through.
+class Renderer : public MeshRenderer {
+public:
+    typedef void *(*GetProcAddress)(const char *name);
+
+    // getProcAddress resolves GL entry points, e.g. SDL_GL_GetProcAddress
+    Renderer(GetProcAddress getProcAddress);
+
+    Renderer(const Renderer &) = delete;
+    Renderer &operator=(const Renderer &) = delete;
+
+    ~Renderer();
+
+    // whether the GL has the buffer objects it needs; without them nothing is drawn
+    bool valid() const { return buffersSupported; }
+
+    int addMesh(const ArrayView<cl_int2> &edges, const ArrayView<cl_int4> &faces) override;
+
+    void removeMesh(int id) override;
+
+    void submit(int id, const cl_float4 *positions, const cl_float4 *normals, size_t count) override;
+
+    void flush() override;
+
+private:
+    struct Mesh {
+        bool used = false;
+        std::vector<GLuint> indices;
+        // edges first, then faces
+        size_t edgeIndices = 0;
+        size_t faceIndices = 0;
+        // first index in the element buffer
+        size_t firstIndex = 0;
+    };
+
+    struct Draw {
+        int mesh;
+        GLint baseVertex;
+    };
+
+    PFNGLGENBUFFERSPROC genBuffers = 0;
+    PFNGLDELETEBUFFERSPROC deleteBuffers = 0;
+    PFNGLBINDBUFFERPROC bindBuffer = 0;
+    PFNGLBUFFERDATAPROC bufferData = 0;
+    PFNGLMULTIDRAWELEMENTSBASEVERTEXPROC multiDrawElementsBaseVertex = 0;
+
+    bool buffersSupported = false;
+
+    GLuint positionVbo = 0;
+    GLuint normalVbo = 0;
+    GLuint indexVbo = 0;
+
+    std::vector<Mesh> meshes;
+    bool indicesDirty = false;
+
+    std::vector<cl_float4> positions;
+    std::vector<cl_float4> normals;
+    std::vector<Draw> draws;
+
+    // scratch of the multi-draw calls
+    std::vector<GLsizei> counts;
+    std::vector<const void *> offsets;
+    std::vector<GLint> baseVertices;
+
+    void uploadIndices();
+
+    // draws the edges (faces = false) or faces of every submitted object
+    void drawElements(GLenum mode, bool faces);
+};
+
+
+#endif //GPGPU_HF_RENDERER_H
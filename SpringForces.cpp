@@ -0,0 +1,139 @@
+#include "SpringForces.hpp"
+
+#include <cctype>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <utility>
+
+static const char *forceMethodNames[] = {"vertex", "colored", "atomic", "auto"};
+
+const char *forceMethodName(ForceMethod method) {
+    return forceMethodNames[(int) method];
+}
+
+bool parseForceMethod(const std::string &name, ForceMethod &method) {
+    std::string lower = name;
+    for (auto &c : lower) c = (char) tolower((unsigned char) c);
+
+    for (int i = 0; i <= (int) ForceMethod::Auto; ++i) {
+        if (lower == forceMethodNames[i]) {
+            method = (ForceMethod) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+ForceMethod SpringForces::defaultMethod = ForceMethod::Auto;
+
+// the result of measure() per (points, edges), so copies of a mesh are only timed once
+static std::map<std::pair<size_t, size_t>, ForceMethod> measured;
+
+SpringForces::SpringForces():
+        chosen{defaultMethod},
+        calcForcesKernel{"calcForces"},
+        initForcesKernel{"initForces"},
+        coloredKernel{"calcForcesColored"},
+        atomicKernel{"calcForcesAtomic"}
+{
+}
+
+void SpringForces::setSprings(CLBuffer<cl_int> &pairOffsets, CLBuffer<cl_int> &pairs, CLBuffer<cl_float2> &pairParams,
+                              const ArrayView<cl_int2> &edges, const ArrayView<cl_float2> &edgeParams,
+                              const ArrayView<cl_int> &colorOffsets) {
+    this->pairOffsets = &pairOffsets;
+    this->pairs = &pairs;
+    this->pairParams = &pairParams;
+
+    this->colorOffsets.assign(colorOffsets.begin(), colorOffsets.end());
+    edgeBuffer.reset(new CLBuffer<cl_int2>(edges.data(), edges.size()));
+    edgeParamBuffer.reset(new CLBuffer<cl_float2>(edgeParams.data(), edgeParams.size()));
+}
+
+void SpringForces::enqueue(ForceMethod method, EventChain &chain, size_t n, CLBuffer<cl_float4> &positions,
+                           CLBuffer<cl_float> &inverseMass, CLBuffer<cl_float4> &force) {
+    size_t edges = edgeBuffer->size();
+
+    switch (method) {
+        case ForceMethod::Vertex:
+        case ForceMethod::Auto:
+            calcForcesKernel.execute(chain, n, positions, inverseMass, *pairOffsets, *pairs, *pairParams, force);
+            break;
+
+        case ForceMethod::Colored:
+            initForcesKernel.execute(chain, n, inverseMass, force);
+            for (size_t c = 0; c + 1 < colorOffsets.size(); ++c) {
+                size_t count = colorOffsets[c + 1] - colorOffsets[c];
+                if (count) {
+                    coloredKernel.execute(chain, count, colorOffsets[c], positions, *edgeBuffer, *edgeParamBuffer, force);
+                }
+            }
+            break;
+
+        case ForceMethod::Atomic:
+            initForcesKernel.execute(chain, n, inverseMass, force);
+            if (edges) {
+                atomicKernel.execute(chain, edges, positions, *edgeBuffer, *edgeParamBuffer, force);
+            }
+            break;
+    }
+}
+
+ForceMethod SpringForces::measure(size_t n, CLBuffer<cl_float4> &positions, CLBuffer<cl_float> &inverseMass,
+                                  CLBuffer<cl_float4> &force) {
+    typedef std::chrono::steady_clock clock;
+
+    const int runs = 20;
+    const ForceMethod candidates[] = {ForceMethod::Vertex, ForceMethod::Colored, ForceMethod::Atomic};
+
+    // the caller's commands finish first, the timed ones do not wait on its chain
+    cl_command_queue queue = CLWrapper::instance->cqueue();
+    clFinish(queue);
+    EventChain chain;
+
+    ForceMethod best = ForceMethod::Vertex;
+    double bestMs = 0;
+
+    std::cout << "spring forces for " << n << " points, " << edgeBuffer->size() << " edges:" << std::fixed;
+    for (ForceMethod method : candidates) {
+        // the first launches include any lazy setup of the driver
+        enqueue(method, chain, n, positions, inverseMass, force);
+        clFinish(queue);
+
+        auto start = clock::now();
+        for (int i = 0; i < runs; ++i) {
+            enqueue(method, chain, n, positions, inverseMass, force);
+        }
+        clFinish(queue);
+        double ms = std::chrono::duration<double, std::milli>(clock::now() - start).count() / runs;
+
+        std::cout << " " << forceMethodName(method) << " " << std::setprecision(3) << ms << " ms";
+        if (method == candidates[0] || ms < bestMs) {
+            best = method;
+            bestMs = ms;
+        }
+    }
+    std::cout << ", using " << forceMethodName(best) << std::endl;
+
+    return best;
+}
+
+void SpringForces::compute(EventChain &chain, size_t n, CLBuffer<cl_float4> &positions,
+                           CLBuffer<cl_float> &inverseMass, CLBuffer<cl_float4> &force) {
+    if (!n) {
+        return;
+    }
+
+    if (chosen == ForceMethod::Auto) {
+        auto key = std::make_pair(n, edgeBuffer->size());
+        auto found = measured.find(key);
+        if (found == measured.end()) {
+            found = measured.insert(std::make_pair(key, measure(n, positions, inverseMass, force))).first;
+        }
+        chosen = found->second;
+    }
+
+    enqueue(chosen, chain, n, positions, inverseMass, force);
+}
@@ -0,0 +1,79 @@
+#ifndef GPGPU_HF_SPRINGFORCES_H
+#define GPGPU_HF_SPRINGFORCES_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <CL/cl_platform.h>
+
+#include "CLBuffer.hpp"
+#include "CLKernel.hpp"
+#include "MeshData.hpp"
+
+enum class ForceMethod {
+    // calcForces: one work-item per point walks all of its springs, so every
+    // spring is evaluated at both ends
+    Vertex,
+    // one work-item per unique edge, one launch per edge color, no atomics
+    Colored,
+    // one work-item per unique edge in a single launch, accumulated with
+    // compare-and-swap float atomics
+    Atomic,
+    // times the three on the first evaluation and keeps the fastest
+    Auto
+};
+
+const char *forceMethodName(ForceMethod method);
+
+bool parseForceMethod(const std::string &name, ForceMethod &method);
+
+// Gravity and spring forces of a set of points. The springs are needed in
+// both layouts: per point (pairOffsets, pairs, pairParams) and as the graph
+// colored unique edges of MeshTopology.
+class SpringForces {
+    ForceMethod chosen;
+
+    CLBuffer<cl_int> *pairOffsets = 0;
+    CLBuffer<cl_int> *pairs = 0;
+    CLBuffer<cl_float2> *pairParams = 0;
+
+    std::vector<cl_int> colorOffsets;
+    std::unique_ptr<CLBuffer<cl_int2>> edgeBuffer;
+    std::unique_ptr<CLBuffer<cl_float2>> edgeParamBuffer;
+
+    CLKernel<cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem> calcForcesKernel;
+    CLKernel<cl_mem, cl_mem> initForcesKernel;
+    CLKernel<int, cl_mem, cl_mem, cl_mem, cl_mem> coloredKernel;
+    CLKernel<cl_mem, cl_mem, cl_mem, cl_mem> atomicKernel;
+
+    void enqueue(ForceMethod method, EventChain &chain, size_t n, CLBuffer<cl_float4> &positions,
+                 CLBuffer<cl_float> &inverseMass, CLBuffer<cl_float4> &force);
+
+    // runs every method a few times and returns the fastest
+    ForceMethod measure(size_t n, CLBuffer<cl_float4> &positions, CLBuffer<cl_float> &inverseMass,
+                        CLBuffer<cl_float4> &force);
+
+public:
+    // the method new objects use, set from the command line
+    static ForceMethod defaultMethod;
+
+    SpringForces();
+
+    // the method in use, Auto until the first evaluation measured them
+    ForceMethod method() const { return chosen; }
+
+    // the per point springs stay owned by the caller; the edges are copied.
+    // A method chosen by Auto is kept, so repacking a VolumeWorld on every
+    // spawn does not stall a frame to time them again.
+    void setSprings(CLBuffer<cl_int> &pairOffsets, CLBuffer<cl_int> &pairs, CLBuffer<cl_float2> &pairParams,
+                    const ArrayView<cl_int2> &edges, const ArrayView<cl_float2> &edgeParams,
+                    const ArrayView<cl_int> &colorOffsets);
+
+    // enqueues writing gravity plus the spring forces of the n points into force
+    void compute(EventChain &chain, size_t n, CLBuffer<cl_float4> &positions,
+                 CLBuffer<cl_float> &inverseMass, CLBuffer<cl_float4> &force);
+};
+
+
+#endif //GPGPU_HF_SPRINGFORCES_H
@@ -1,40 +1,55 @@
 #ifndef GPGPU_HF_SPRINGYOBJECT_H
 #define GPGPU_HF_SPRINGYOBJECT_H
 
-#include <GL/gl.h>
 #include <CL/cl_platform.h>
 
 #include "CLBuffer.hpp"
 #include "CLKernel.hpp"
-#include "ObjLoader.hpp"
+#include "MeshData.hpp"
 #include "AbstractObject.hpp"
+#include "Integrator.hpp"
+#include "SpringForces.hpp"
+#include "RenderedMesh.hpp"
+#include "ReadbackRing.hpp"
 
 class SpringyObject : public AbstractObject {
-    ObjLoader obj;
-
-    int maxDegree = 64;
+    MeshData mesh;
 
     CLBuffer<cl_float4> positionBuffer;
     CLBuffer<cl_float4> velocityBuffer;
     CLBuffer<cl_float> inverseMassBuffer;
     CLBuffer<cl_float4> forceBuffer;
 
-    CLBuffer<cl_int> degreeBuffer;
-
+    CLBuffer<cl_int> pairOffsetBuffer;
     CLBuffer<cl_int> pairBuffer;
     CLBuffer<cl_float2> pairParamBuffer;
 
-    CLKernel<int, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem> calcForcesKernel;
-    CLKernel<float, cl_mem, cl_mem, cl_mem, cl_mem> integrate1EulerKernel;
-    CLKernel<float, cl_mem, cl_mem, cl_mem> integrate2EulerKernel;
+    // orders the launches of this object on an out-of-order queue
+    EventChain chain;
+
+    SpringForces springs;
+
+    TimeIntegrator integrator;
+
+    RenderedMesh rendered;
 
+    // positions of the last frames, on their way to render()
+    ReadbackRing<cl_float4> readback;
 
 public:
     SpringyObject(const std::string &filename);
 
     void step(float dt);
 
+    void endFrame() override;
+
     void render();
+
+    size_t vertexCount() const { return mesh.points.size(); }
+
+    void readPositions(std::vector<cl_float4> &positions);
+
+    void setIntegrator(Integrator integrator) override { this->integrator.setIntegrator(integrator); }
 };
 
 
@@ -0,0 +1,106 @@
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+
+size_t ThreadPool::defaultThreads = 0;
+
+ThreadPool::ThreadPool(size_t threads) : next{0} {
+    if (!threads) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    for (size_t i = 1; i < threads; ++i) {
+        workers.emplace_back(&ThreadPool::run, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (auto &w : workers) {
+        w.join();
+    }
+}
+
+ThreadPool &ThreadPool::shared() {
+    static ThreadPool pool(defaultThreads);
+    return pool;
+}
+
+void ThreadPool::work(const RangeFunction &body, size_t count, size_t grain) {
+    for (;;) {
+        size_t begin = next.fetch_add(grain);
+        if (begin >= count) {
+            return;
+        }
+        body(begin, std::min(begin + grain, count));
+    }
+}
+
+void ThreadPool::run() {
+    uint64_t seen = 0;
+
+    for (;;) {
+        const RangeFunction *loopBody;
+        size_t loopCount, loopGrain;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            wake.wait(guard, [&] { return stopping || generation != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+            loopBody = body;
+            loopCount = count;
+            loopGrain = grain;
+        }
+
+        work(*loopBody, loopCount, loopGrain);
+
+        std::lock_guard<std::mutex> guard(lock);
+        if (--pending == 0) {
+            done.notify_all();
+        }
+    }
+}
+
+void ThreadPool::parallelFor(size_t n, size_t grain, const RangeFunction &body) {
+    grain = std::max<size_t>(grain, 1);
+    if (!n) {
+        return;
+    }
+    if (n <= grain) {
+        body(0, n);
+        return;
+    }
+    // without workers the caller still gets ranges of grain, so per range
+    // results (e.g. partial sums) do not depend on the thread count
+    if (workers.empty()) {
+        for (size_t begin = 0; begin < n; begin += grain) {
+            body(begin, std::min(begin + grain, n));
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> one(serial);
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        this->body = &body;
+        this->count = n;
+        this->grain = grain;
+        next = 0;
+        pending = workers.size();
+        ++generation;
+    }
+    wake.notify_all();
+
+    work(body, n, grain);
+
+    // every worker takes part in every loop, even if only to find it finished
+    std::unique_lock<std::mutex> guard(lock);
+    done.wait(guard, [&] { return pending == 0; });
+}
@@ -0,0 +1,64 @@
+#ifndef GPGPU_HF_THREADPOOL_H
+#define GPGPU_HF_THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for data-parallel loops. The calling thread
+// works along, so a pool of one thread has no workers at all.
+class ThreadPool {
+public:
+    typedef std::function<void(size_t begin, size_t end)> RangeFunction;
+
+    // 0 uses every hardware thread
+    ThreadPool(size_t threads = 0);
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    ~ThreadPool();
+
+    // threads taking part in a loop, the caller included
+    size_t size() const { return workers.size() + 1; }
+
+    // calls body on disjoint ranges of at most grain indices covering [0, n)
+    // and returns when all of them are done; loops of different callers run
+    // one after the other
+    void parallelFor(size_t n, size_t grain, const RangeFunction &body);
+
+    // the pool of the native backend, created on first use with defaultThreads
+    static ThreadPool &shared();
+
+    // set before the first shared() call, e.g. from the command line
+    static size_t defaultThreads;
+
+private:
+    std::vector<std::thread> workers;
+
+    std::mutex serial;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    // the current loop, set under lock
+    const RangeFunction *body = 0;
+    size_t count = 0;
+    size_t grain = 1;
+    std::atomic<size_t> next;
+    uint64_t generation = 0;
+    size_t pending = 0;
+    bool stopping = false;
+
+    void run();
+
+    // takes ranges of the current loop until none are left
+    void work(const RangeFunction &body, size_t count, size_t grain);
+};
+
+
+#endif //GPGPU_HF_THREADPOOL_H
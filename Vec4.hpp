@@ -0,0 +1,124 @@
+#ifndef GPGPU_HF_VEC4_H
+#define GPGPU_HF_VEC4_H
+
+#include <cmath>
+
+#include <CL/cl_platform.h>
+
+// The float4 arithmetic of the kernels for the native backend: one point per
+// 128 bit register with SSE (with FMA where the target has it, e.g. AVX2) or
+// NEON, plain floats elsewhere. The layout is that of cl_float4, so the
+// native code keeps the arrays of the device path.
+#if defined(__SSE__) || defined(_M_X64)
+#include <immintrin.h>
+#define GPGPU_HF_VEC4_SSE
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define GPGPU_HF_VEC4_NEON
+#endif
+
+struct Vec4 {
+#if defined(GPGPU_HF_VEC4_SSE)
+    __m128 v;
+
+    Vec4() : v{_mm_setzero_ps()} {}
+    Vec4(__m128 v) : v{v} {}
+    Vec4(float x, float y, float z, float w) : v{_mm_setr_ps(x, y, z, w)} {}
+
+    static Vec4 load(const cl_float4 &p) { return _mm_loadu_ps(p.s); }
+    void store(cl_float4 &p) const { _mm_storeu_ps(p.s, v); }
+
+    Vec4 operator+(Vec4 o) const { return _mm_add_ps(v, o.v); }
+    Vec4 operator-(Vec4 o) const { return _mm_sub_ps(v, o.v); }
+    Vec4 operator*(float s) const { return _mm_mul_ps(v, _mm_set1_ps(s)); }
+
+    // this + o * s
+    Vec4 madd(Vec4 o, float s) const {
+#ifdef __FMA__
+        return _mm_fmadd_ps(o.v, _mm_set1_ps(s), v);
+#else
+        return _mm_add_ps(v, _mm_mul_ps(o.v, _mm_set1_ps(s)));
+#endif
+    }
+
+    float dot(Vec4 o) const {
+        __m128 m = _mm_mul_ps(v, o.v);
+        __m128 s = _mm_add_ps(m, _mm_movehl_ps(m, m));
+        s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+        return _mm_cvtss_f32(s);
+    }
+
+    // w is zero, like cross() of OpenCL
+    Vec4 cross(Vec4 o) const {
+        __m128 a = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 0, 2, 1));
+        __m128 b = _mm_shuffle_ps(o.v, o.v, _MM_SHUFFLE(3, 0, 2, 1));
+        __m128 c = _mm_sub_ps(_mm_mul_ps(v, b), _mm_mul_ps(a, o.v));
+        c = _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+        return _mm_and_ps(c, _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0)));
+    }
+
+    float z() const { return _mm_cvtss_f32(_mm_shuffle_ps(v, v, 2)); }
+#elif defined(GPGPU_HF_VEC4_NEON)
+    float32x4_t v;
+
+    Vec4() : v{vdupq_n_f32(0)} {}
+    Vec4(float32x4_t v) : v{v} {}
+    Vec4(float x, float y, float z, float w) {
+        float s[4] = {x, y, z, w};
+        v = vld1q_f32(s);
+    }
+
+    static Vec4 load(const cl_float4 &p) { return vld1q_f32(p.s); }
+    void store(cl_float4 &p) const { vst1q_f32(p.s, v); }
+
+    Vec4 operator+(Vec4 o) const { return vaddq_f32(v, o.v); }
+    Vec4 operator-(Vec4 o) const { return vsubq_f32(v, o.v); }
+    Vec4 operator*(float s) const { return vmulq_n_f32(v, s); }
+
+    Vec4 madd(Vec4 o, float s) const { return vmlaq_n_f32(v, o.v, s); }
+
+    float dot(Vec4 o) const {
+        float32x4_t m = vmulq_f32(v, o.v);
+        float32x2_t s = vadd_f32(vget_low_f32(m), vget_high_f32(m));
+        return vget_lane_f32(vpadd_f32(s, s), 0);
+    }
+
+    Vec4 cross(Vec4 o) const {
+        float a[4], b[4];
+        vst1q_f32(a, v);
+        vst1q_f32(b, o.v);
+        return Vec4(a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0], 0);
+    }
+
+    float z() const { return vgetq_lane_f32(v, 2); }
+#else
+    float v[4];
+
+    Vec4() : v{0, 0, 0, 0} {}
+    Vec4(float x, float y, float z, float w) : v{x, y, z, w} {}
+
+    static Vec4 load(const cl_float4 &p) { return Vec4(p.s[0], p.s[1], p.s[2], p.s[3]); }
+    void store(cl_float4 &p) const { for (int i = 0; i < 4; ++i) p.s[i] = v[i]; }
+
+    Vec4 operator+(Vec4 o) const { return Vec4(v[0] + o.v[0], v[1] + o.v[1], v[2] + o.v[2], v[3] + o.v[3]); }
+    Vec4 operator-(Vec4 o) const { return Vec4(v[0] - o.v[0], v[1] - o.v[1], v[2] - o.v[2], v[3] - o.v[3]); }
+    Vec4 operator*(float s) const { return Vec4(v[0] * s, v[1] * s, v[2] * s, v[3] * s); }
+
+    Vec4 madd(Vec4 o, float s) const { return *this + o * s; }
+
+    float dot(Vec4 o) const { return v[0] * o.v[0] + v[1] * o.v[1] + v[2] * o.v[2] + v[3] * o.v[3]; }
+
+    Vec4 cross(Vec4 o) const {
+        return Vec4(v[1] * o.v[2] - v[2] * o.v[1], v[2] * o.v[0] - v[0] * o.v[2], v[0] * o.v[1] - v[1] * o.v[0], 0);
+    }
+
+    float z() const { return v[2]; }
+#endif
+
+    Vec4 &operator+=(Vec4 o) { return *this = *this + o; }
+
+    float length() const { return std::sqrt(dot(*this)); }
+};
+
+
+#endif //GPGPU_HF_VEC4_H
@@ -3,212 +3,134 @@
 #include <cmath>
 #include <CL/cl_platform.h>
 
-VolumeMesh::VolumeMesh(const std::string &filename):
-        obj{filename},
-        positionBuffer{obj.points.size()},
-        velocityBuffer{obj.points.size()},
-        inverseMassBuffer{obj.points.size()},
-        forceBuffer{obj.points.size()},
-        normalBuffer{obj.points.size()},
-        degreeBuffer{obj.points.size()},
-        pairBuffer{obj.points.size() * maxDegree},
-        pairParamBuffer{obj.points.size() * maxDegree},
-        faceBuffer{obj.faces.size()},
-        corneredBuffer{obj.points.size()},
-        otherCornerBuffer{obj.points.size() * maxCornered},
-        volumeBuffer{obj.faces.size()},
-        calcForcesKernel{"calcForces"},
-        calcVolumesKernel{"calcVolumes"},
+VolumeMesh::VolumeMesh(const std::string &filename) : VolumeMesh(MeshData(filename, springStrength)) {
+}
+
+VolumeMesh::VolumeMesh(MeshData &&loaded):
+        mesh{std::move(loaded)},
+        volumePartialCount{(mesh.faces.size() + reduceGroupSize - 1) / reduceGroupSize},
+        positionBuffer{mesh.points.data(), mesh.points.size()},
+        nextPositionBuffer{mesh.points.size()},
+        velocityBuffer{mesh.points.size()},
+        inverseMassBuffer{std::vector<cl_float>(mesh.points.size(), 10)},
+        forceBuffer{mesh.points.size()},
+        normalBuffer{mesh.points.size()},
+        pairOffsetBuffer{mesh.pairOffsets.data(), mesh.pairOffsets.size()},
+        pairBuffer{mesh.pairs.data(), mesh.pairs.size()},
+        pairParamBuffer{mesh.pairParams.data(), mesh.pairParams.size()},
+        faceBuffer{mesh.faces.data(), mesh.faces.size()},
+        cornerOffsetBuffer{mesh.cornerOffsets.data(), mesh.cornerOffsets.size()},
+        otherCornerBuffer{mesh.otherCorners.data(), mesh.otherCorners.size()},
+        volumePartialBuffer{volumePartialCount},
+        volumeBuffer{1},
+        calcVolumesKernel{"calcVolumes", reduceGroupSize},
+        sumVolumesKernel{"sumVolumes", reduceGroupSize},
         applyPressureKernel{"applyPressure"},
         calcNormalsKernel{"calcNormals"},
-        integrate1EulerKernel{"integrate1Euler"},
-        integrate2EulerKernel{"integrate2Euler"}
+        stepFusedKernel{"stepFused"},
+        integrator{mesh.points.size()},
+        readback{mesh.points.size(), 2}
 {
-    auto positions = positionBuffer.map();
-    auto velocities = velocityBuffer.map();
-    auto inverseMasses = inverseMassBuffer.map();
-    auto degrees = degreeBuffer.map();
-    auto pairs = pairBuffer.map();
-    auto pairParams = pairParamBuffer.map();
-    auto cornereds = corneredBuffer.map();
-    auto otherCorners = otherCornerBuffer.map();
-    auto faces = faceBuffer.map();
-
-    for (size_t i = 0; i < obj.points.size(); ++i) {
-        positions[i] = obj.points[i];
-
-        velocities[i].s[0] = 0;
-        velocities[i].s[1] = 0;
-        velocities[i].s[2] = 0;
-        velocities[i].s[3] = 0;
-
-        inverseMasses[i] = 10;
-        degrees[i] = 0;
-    }
-
-    for (size_t i = 0; i < obj.edges.size(); ++i) {
-        int a = obj.edges[i].s[0];
-        int b = obj.edges[i].s[1];
-
-        if ((degrees[a] >= maxDegree) || (degrees[b] >= maxDegree)) {
-            std::cerr << "TOO MANY EDGES!\n";
-            continue;
-        }
-
-        float dx = positions[a].s[0] - positions[b].s[0];
-        float dy = positions[a].s[1] - positions[b].s[1];
-        float dz = positions[a].s[2] - positions[b].s[2];
-
-        float dist = sqrtf(dx*dx + dy*dy + dz*dz);
-        float strength = 4000;
-
-        pairs[maxDegree * a + degrees[a]] = b;
-        pairs[maxDegree * b + degrees[b]] = a;
-
-        pairParams[maxDegree * a + degrees[a]].s[0] = dist;
-        pairParams[maxDegree * a + degrees[a]].s[1] = strength;
-
-        pairParams[maxDegree * b + degrees[b]].s[0] = dist;
-        pairParams[maxDegree * b + degrees[b]].s[1] = strength;
+    springs.setSprings(pairOffsetBuffer, pairBuffer, pairParamBuffer,
+                       mesh.constraints, mesh.constraintParams, mesh.colorOffsets);
+    integrator.setSprings(pairOffsetBuffer, pairBuffer, pairParamBuffer);
+    initVolume = mesh.volume();
+}
 
-        ++degrees[a];
-        ++degrees[b];
+void VolumeMesh::setIntegrator(Integrator integrator) {
+    if (integrator != Integrator::XPBD) {
+        xpbd.reset();
+        this->integrator.setIntegrator(integrator);
+        return;
     }
 
-    for (size_t i = 0; i < obj.faces.size(); ++i) {
-        int a = obj.faces[i].s[0];
-        int b = obj.faces[i].s[1];
-        int c = obj.faces[i].s[2];
-
-        if ((cornereds[a] >= maxCornered) || (cornereds[b] >= maxCornered) || (cornereds[c] >= maxCornered)) {
-            std::cerr << "TOO MANY FACES!\n";
-            continue;
-        }
+    if (!xpbd) {
+        xpbd.reset(new XPBDSolver(mesh));
+    }
+}
 
-        otherCorners[maxCornered * a + cornereds[a]].s[0] = b;
-        otherCorners[maxCornered * a + cornereds[a]].s[1] = c;
+void VolumeMesh::step(float dt) {
+    if (xpbd) {
+        xpbd->step(dt, std::exp(-integrator.dampingRate * dt), initVolume, chain,
+                   positionBuffer, velocityBuffer, inverseMassBuffer,
+                   faceBuffer, cornerOffsetBuffer, otherCornerBuffer);
 
-        otherCorners[maxCornered * b + cornereds[b]].s[0] = c;
-        otherCorners[maxCornered * b + cornereds[b]].s[1] = a;
+        calcNormalsKernel.execute(chain, mesh.points.size(), positionBuffer, cornerOffsetBuffer, otherCornerBuffer, normalBuffer);
+        return;
+    }
 
-        otherCorners[maxCornered * c + cornereds[c]].s[0] = a;
-        otherCorners[maxCornered * c + cornereds[c]].s[1] = b;
+    if (fused && integrator.integrator() == Integrator::Euler) {
+        calcVolume(positionBuffer);
 
+        stepFusedKernel.execute(chain, mesh.points.size(), dt, initVolume, volumeBuffer,
+                                positionBuffer, inverseMassBuffer, pairOffsetBuffer, pairBuffer, pairParamBuffer,
+                                cornerOffsetBuffer, otherCornerBuffer, velocityBuffer, nextPositionBuffer);
+        positionBuffer.swap(nextPositionBuffer);
 
-        ++cornereds[a];
-        ++cornereds[b];
-        ++cornereds[c];
+        calcNormalsKernel.execute(chain, mesh.points.size(), positionBuffer, cornerOffsetBuffer, otherCornerBuffer, normalBuffer);
+        return;
     }
 
+    integrator.step(dt, chain, positionBuffer, velocityBuffer, inverseMassBuffer, forceBuffer,
+                    [this](CLBuffer<cl_float4> &positions, CLBuffer<cl_float4> &force) {
+                        computeForces(positions, force);
+                    });
 
-    for (size_t i = 0; i < obj.faces.size(); ++i) {
-        faces[i] = obj.faces[i];
-    }
-
-    positionBuffer.unmap();
-    velocityBuffer.unmap();
-    inverseMassBuffer.unmap();
-    degreeBuffer.unmap();
-    pairBuffer.unmap();
-    pairParamBuffer.unmap();
-    corneredBuffer.unmap();
-    otherCornerBuffer.unmap();
-    faceBuffer.unmap();
-
-    initVolume = getVolume();
+    calcNormalsKernel.execute(chain, mesh.points.size(), positionBuffer, cornerOffsetBuffer, otherCornerBuffer, normalBuffer);
 }
 
-void VolumeMesh::step(float dt) {
-    float volumeNow = getVolume();
-
-    //std::cout << "volume is " << volumeNow << " now, but was " << initVolume << std::endl;
-
-    calcForcesKernel.execute(obj.points.size(), maxDegree, positionBuffer, inverseMassBuffer, degreeBuffer, pairBuffer, pairParamBuffer, forceBuffer);
+void VolumeMesh::computeForces(CLBuffer<cl_float4> &positions, CLBuffer<cl_float4> &force) {
+    calcVolume(positions);
 
-    applyPressureKernel.execute(obj.points.size(), initVolume - volumeNow, maxCornered, positionBuffer, corneredBuffer, otherCornerBuffer, forceBuffer);
+    springs.compute(chain, mesh.points.size(), positions, inverseMassBuffer, force);
 
-    integrate1EulerKernel.execute(obj.points.size(), dt, inverseMassBuffer, velocityBuffer, forceBuffer, velocityBuffer);
+    applyPressureKernel.execute(chain, mesh.points.size(), initVolume, volumeBuffer, positions, cornerOffsetBuffer, otherCornerBuffer, force);
+}
 
-    integrate2EulerKernel.execute(obj.points.size(), dt, positionBuffer, velocityBuffer, positionBuffer);
+void VolumeMesh::calcVolume(CLBuffer<cl_float4> &positions) {
+    calcVolumesKernel.execute(chain, mesh.faces.size(), mesh.faces.size(), positions, faceBuffer, volumePartialBuffer);
 
-    calcNormalsKernel.execute(obj.points.size(), maxCornered, positionBuffer, corneredBuffer, otherCornerBuffer, normalBuffer);
+    sumVolumesKernel.execute(chain, reduceGroupSize, volumePartialCount, volumePartialBuffer, volumeBuffer);
 }
 
 float VolumeMesh::getVolume() {
-    calcVolumesKernel.execute(obj.faces.size(), positionBuffer, faceBuffer, volumeBuffer);
-
-    auto volumes = volumeBuffer.map();
-
-    float sum = 0;
+    calcVolume(positionBuffer);
 
-    for (size_t i = 0 ; i < obj.faces.size(); ++i) {
-        sum += volumes[i];
-    }
+    float volume = *volumeBuffer.map();
 
     volumeBuffer.unmap();
 
-    return sum;
+    return volume;
 }
 
-void VolumeMesh::render() {
-    auto positions = positionBuffer.map();
-    auto normals = normalBuffer.map();
-
-    glPointSize(3);
-
-
-    glColor4f(1,1,1,1);
-    glEnableClientState(GL_VERTEX_ARRAY);
-    glVertexPointer(3, GL_FLOAT, 16, positions);
-
-    glDrawArrays(GL_POINTS, 0, obj.points.size());
-
-    glDisableClientState(GL_VERTEX_ARRAY);
-
+void VolumeMesh::readPositions(std::vector<cl_float4> &positions) {
+    auto mapped = positionBuffer.map();
 
-/*
-    glBegin(GL_POINTS);
-    glColor4f(1,1,1,1);
-    for (int i = 0; i < obj.points.size(); ++i) {
-        glVertex3fv(positions[i].s);
+    positions.resize(mesh.points.size());
+    for (size_t i = 0; i < mesh.points.size(); ++i) {
+        positions[mesh.originalIndex[i]] = mapped[i];
     }
-    glEnd();
-*/
 
+    positionBuffer.unmap();
+}
 
+void VolumeMesh::endFrame() {
+    readback.enqueue({&positionBuffer, &normalBuffer}, chain);
+}
 
-    glBegin(GL_LINES);
-    glColor3f(0.8, 0.4, 0.2);
-    for (auto &e : obj.edges) {
-        glVertex3fv(positions[e.s[0]].s);
-        glVertex3fv(positions[e.s[1]].s);
-    }
-    glEnd();
-
-    glEnable(GL_LIGHTING);
-    glBegin(GL_TRIANGLES);
-    glColor3f(0.2, 0.4, 0.8);
-    for (auto &f : obj.faces) {
-        glNormal3fv(normals[f.s[0]].s);
-        glVertex3fv(positions[f.s[0]].s);
-
-        glNormal3fv(normals[f.s[1]].s);
-        glVertex3fv(positions[f.s[1]].s);
-
-        glNormal3fv(normals[f.s[2]].s);
-        glVertex3fv(positions[f.s[2]].s);
+void VolumeMesh::render() {
+    auto positions = readback.latest();
+    if (positions) {
+        rendered.submit(mesh, positions, positions + mesh.points.size());
     }
-    glEnd();
-    glDisable(GL_LIGHTING);
-
-    positionBuffer.unmap();
-    normalBuffer.unmap();
 }
 
 void VolumeMesh::inflate(float dt) {
     initVolume += dt * 10;
+    integrator.invalidateForce();
 }
 
 void VolumeMesh::deflate(float dt) {
     initVolume -= dt * 10l;
+    integrator.invalidateForce();
 }
\ No newline at end of file
@@ -2,56 +2,99 @@
 #define GPGPU_HF_VOLUMEMESH_H
 
 
-#include <GL/gl.h>
 #include <CL/cl_platform.h>
 
 #include "CLBuffer.hpp"
 #include "CLKernel.hpp"
-#include "ObjLoader.hpp"
+#include "MeshData.hpp"
 #include "AbstractObject.hpp"
+#include "Integrator.hpp"
+#include "XPBDSolver.hpp"
+#include "SpringForces.hpp"
+#include "RenderedMesh.hpp"
+#include "ReadbackRing.hpp"
 
 class VolumeMesh : public AbstractObject {
-    ObjLoader obj;
+    MeshData mesh;
 
-    int maxDegree = 64;
-    int maxCornered = 16;
+    // REDUCE_GROUP_SIZE in programs.cl
+    size_t reduceGroupSize = 128;
+    size_t volumePartialCount;
 
     float initVolume;
 
+    // use the single stepFused kernel instead of the separate ones (Euler only)
+    bool fused = false;
+
     CLBuffer<cl_float4> positionBuffer;
+    CLBuffer<cl_float4> nextPositionBuffer;
     CLBuffer<cl_float4> velocityBuffer;
     CLBuffer<cl_float> inverseMassBuffer;
     CLBuffer<cl_float4> forceBuffer;
 
     CLBuffer<cl_float4> normalBuffer;
 
-    CLBuffer<cl_int> degreeBuffer;
-
+    CLBuffer<cl_int> pairOffsetBuffer;
     CLBuffer<cl_int> pairBuffer;
     CLBuffer<cl_float2> pairParamBuffer;
 
     CLBuffer<cl_int4> faceBuffer;
-    CLBuffer<cl_int> corneredBuffer;
+    CLBuffer<cl_int> cornerOffsetBuffer;
     CLBuffer<cl_int2> otherCornerBuffer;
+    CLBuffer<cl_float> volumePartialBuffer;
     CLBuffer<cl_float> volumeBuffer;
 
 
-    CLKernel<int, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem> calcForcesKernel;
-    CLKernel<cl_mem, cl_mem, cl_mem> calcVolumesKernel;
-    CLKernel<float, int, cl_mem, cl_mem, cl_mem, cl_mem> applyPressureKernel;
-    CLKernel<int, cl_mem, cl_mem, cl_mem, cl_mem> calcNormalsKernel;
-    CLKernel<float, cl_mem, cl_mem, cl_mem, cl_mem> integrate1EulerKernel;
-    CLKernel<float, cl_mem, cl_mem, cl_mem> integrate2EulerKernel;
+    // orders the launches of this object on an out-of-order queue
+    EventChain chain;
+
+    CLKernel<int, cl_mem, cl_mem, cl_mem> calcVolumesKernel;
+    CLKernel<int, cl_mem, cl_mem> sumVolumesKernel;
+    CLKernel<float, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem> applyPressureKernel;
+    CLKernel<cl_mem, cl_mem, cl_mem, cl_mem> calcNormalsKernel;
+    CLKernel<float, float, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem> stepFusedKernel;
+
+    SpringForces springs;
+    TimeIntegrator integrator;
+
+    // set while the XPBD solver replaces the integrator and the forces
+    std::unique_ptr<XPBDSolver> xpbd;
+
+    RenderedMesh rendered;
+
+    // positions and normals of the last frames, on their way to render()
+    ReadbackRing<cl_float4> readback;
+
+    // enqueues the reduction of the volume at the given positions into volumeBuffer
+    void calcVolume(CLBuffer<cl_float4> &positions);
+
+    // spring and pressure forces at the given positions
+    void computeForces(CLBuffer<cl_float4> &positions, CLBuffer<cl_float4> &force);
 
 public:
+    // spring strength of every volume mesh
+    static constexpr float springStrength = 4000;
+
     VolumeMesh(const std::string &filename);
 
+    // takes over a mesh loaded elsewhere, e.g. by a MeshLoader
+    VolumeMesh(MeshData &&loaded);
+
     float getVolume();
     void step(float dt);
+    void endFrame() override;
     void render();
 
+    size_t vertexCount() const { return mesh.points.size(); }
+
+    void readPositions(std::vector<cl_float4> &positions);
+
     void inflate(float dt) override;
     void deflate(float dt) override;
+
+    void setFused(bool fused) override { this->fused = fused; }
+
+    void setIntegrator(Integrator integrator) override;
 };
 
 
@@ -0,0 +1,345 @@
+#include "VolumeWorld.hpp"
+#include "VolumeMesh.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+VolumeWorld::VolumeWorld():
+        calcVolumesKernel{"calcVolumesWorld", reduceGroupSize},
+        sumVolumesKernel{"sumVolumesWorld", reduceGroupSize},
+        applyPressureKernel{"applyPressureWorld"},
+        calcNormalsKernel{"calcNormals"},
+        stepFusedKernel{"stepFusedWorld"},
+        integrator{0}
+{
+    pack();
+}
+
+void VolumeWorld::add(const std::string &filename) {
+    add(std::unique_ptr<MeshData>(new MeshData(filename, VolumeMesh::springStrength)));
+}
+
+void VolumeWorld::add(std::unique_ptr<MeshData> mesh) {
+    saveState();
+
+    // stack it a tenth of its height above the highest point in the world
+    std::vector<cl_float4> positions;
+    if (collisions && vertices) {
+        float top = -INFINITY;
+        for (const auto &o : objects) {
+            for (const auto &p : o.positions) {
+                top = std::max(top, p.s[2]);
+            }
+        }
+
+        float bottom = INFINITY, ceiling = -INFINITY;
+        for (const auto &p : mesh->points) {
+            bottom = std::min(bottom, p.s[2]);
+            ceiling = std::max(ceiling, p.s[2]);
+        }
+
+        float lift = top - bottom + (ceiling - bottom) / 10;
+        for (auto p : mesh->points) {
+            p.s[2] += lift;
+            positions.push_back(p);
+        }
+    }
+
+    objects.emplace_back();
+    objects.back().initVolume = mesh->volume();
+    if (!positions.empty()) {
+        objects.back().velocities.assign(positions.size(), cl_float4{{0, 0, 0, 0}});
+        objects.back().positions = std::move(positions);
+    }
+    objects.back().mesh = std::move(mesh);
+
+    pack();
+}
+
+void VolumeWorld::remove(size_t index) {
+    if (index >= objects.size()) {
+        return;
+    }
+
+    saveState();
+    objects.erase(objects.begin() + index);
+    pack();
+}
+
+void VolumeWorld::removeLast() {
+    if (!objects.empty()) {
+        remove(objects.size() - 1);
+    }
+}
+
+void VolumeWorld::saveState() {
+    if (!vertices) {
+        return;
+    }
+
+    auto positions = positionBuffer->map();
+    auto velocities = velocityBuffer->map();
+
+    for (auto &o : objects) {
+        size_t n = o.mesh->points.size();
+        o.positions.assign(positions + o.vertexOffset, positions + o.vertexOffset + n);
+        o.velocities.assign(velocities + o.vertexOffset, velocities + o.vertexOffset + n);
+    }
+
+    positionBuffer->unmap();
+    velocityBuffer->unmap();
+}
+
+void VolumeWorld::pack() {
+    std::vector<cl_float4> positions, velocities;
+    std::vector<cl_int> objectIndex;
+    std::vector<cl_int> pairOffsets, pairs;
+    std::vector<cl_float2> pairParams;
+    std::vector<cl_int4> faces;
+    std::vector<cl_int> faceOffsets, cornerOffsets;
+    std::vector<cl_int2> otherCorners;
+    std::vector<cl_float> initVolumes;
+    std::vector<cl_int> partialOffsets, groupObjects;
+
+    cl_float4 zero = {{0, 0, 0, 0}};
+
+    for (size_t k = 0; k < objects.size(); ++k) {
+        Object &o = objects[k];
+        const MeshData &mesh = *o.mesh;
+
+        o.vertexOffset = positions.size();
+
+        cl_int vertexBase = (cl_int) o.vertexOffset;
+        cl_int pairBase = (cl_int) pairs.size();
+        cl_int cornerBase = (cl_int) otherCorners.size();
+        size_t n = mesh.points.size();
+
+        if (o.positions.size() == n) {
+            positions.insert(positions.end(), o.positions.begin(), o.positions.end());
+            velocities.insert(velocities.end(), o.velocities.begin(), o.velocities.end());
+        } else {
+            positions.insert(positions.end(), mesh.points.begin(), mesh.points.end());
+            velocities.insert(velocities.end(), n, zero);
+        }
+        objectIndex.insert(objectIndex.end(), n, (cl_int) k);
+
+        for (size_t i = 0; i < n; ++i) {
+            pairOffsets.push_back(pairBase + mesh.pairOffsets[i]);
+            cornerOffsets.push_back(cornerBase + mesh.cornerOffsets[i]);
+        }
+        for (auto p : mesh.pairs) {
+            pairs.push_back(vertexBase + p);
+        }
+        pairParams.insert(pairParams.end(), mesh.pairParams.begin(), mesh.pairParams.end());
+
+        for (auto c : mesh.otherCorners) {
+            c.s[0] += vertexBase;
+            c.s[1] += vertexBase;
+            otherCorners.push_back(c);
+        }
+
+        faceOffsets.push_back((cl_int) faces.size());
+        partialOffsets.push_back((cl_int) groupObjects.size());
+        groupObjects.insert(groupObjects.end(), (mesh.faces.size() + reduceGroupSize - 1) / reduceGroupSize, (cl_int) k);
+        for (auto f : mesh.faces) {
+            f.s[0] += vertexBase;
+            f.s[1] += vertexBase;
+            f.s[2] += vertexBase;
+            faces.push_back(f);
+        }
+
+        initVolumes.push_back(o.initVolume);
+
+        // the saved state now lives in the buffers
+        std::vector<cl_float4>().swap(o.positions);
+        std::vector<cl_float4>().swap(o.velocities);
+    }
+    pairOffsets.push_back((cl_int) pairs.size());
+    cornerOffsets.push_back((cl_int) otherCorners.size());
+    faceOffsets.push_back((cl_int) faces.size());
+    partialOffsets.push_back((cl_int) groupObjects.size());
+
+    // color c of the world is color c of every object, which share no points
+    std::vector<cl_int2> edges;
+    std::vector<cl_float2> edgeParams;
+    std::vector<cl_int> colorOffsets(1, 0);
+
+    size_t colors = 0;
+    for (const auto &o : objects) {
+        colors = std::max(colors, o.mesh->colorOffsets.size() - 1);
+    }
+    for (size_t c = 0; c < colors; ++c) {
+        for (const auto &o : objects) {
+            const MeshData &mesh = *o.mesh;
+            if (c + 1 >= mesh.colorOffsets.size()) {
+                continue;
+            }
+
+            for (int k = mesh.colorOffsets[c]; k < mesh.colorOffsets[c + 1]; ++k) {
+                cl_int2 e = mesh.constraints[k];
+                e.s[0] += (cl_int) o.vertexOffset;
+                e.s[1] += (cl_int) o.vertexOffset;
+                edges.push_back(e);
+                edgeParams.push_back(mesh.constraintParams[k]);
+            }
+        }
+        colorOffsets.push_back((cl_int) edges.size());
+    }
+
+    vertices = positions.size();
+
+    positionBuffer.reset(new CLBuffer<cl_float4>(positions));
+    nextPositionBuffer.reset(new CLBuffer<cl_float4>(vertices));
+    velocityBuffer.reset(new CLBuffer<cl_float4>(velocities));
+    inverseMassBuffer.reset(new CLBuffer<cl_float>(std::vector<cl_float>(vertices, 10)));
+    forceBuffer.reset(new CLBuffer<cl_float4>(vertices));
+    normalBuffer.reset(new CLBuffer<cl_float4>(vertices));
+    objectBuffer.reset(new CLBuffer<cl_int>(objectIndex));
+    pairOffsetBuffer.reset(new CLBuffer<cl_int>(pairOffsets));
+    pairBuffer.reset(new CLBuffer<cl_int>(pairs));
+    pairParamBuffer.reset(new CLBuffer<cl_float2>(pairParams));
+    faceBuffer.reset(new CLBuffer<cl_int4>(faces));
+    faceOffsetBuffer.reset(new CLBuffer<cl_int>(faceOffsets));
+    cornerOffsetBuffer.reset(new CLBuffer<cl_int>(cornerOffsets));
+    otherCornerBuffer.reset(new CLBuffer<cl_int2>(otherCorners));
+    initVolumeBuffer.reset(new CLBuffer<cl_float>(initVolumes));
+    volumeBuffer.reset(new CLBuffer<cl_float>(objects.size()));
+    volumePartialCount = groupObjects.size();
+    volumePartialBuffer.reset(new CLBuffer<cl_float>(volumePartialCount));
+    partialOffsetBuffer.reset(new CLBuffer<cl_int>(partialOffsets));
+    groupObjectBuffer.reset(new CLBuffer<cl_int>(groupObjects));
+    readback.reset(new ReadbackRing<cl_float4>(vertices, 2));
+
+    grid.setFaces(positions, faces);
+    springs.setSprings(*pairOffsetBuffer, *pairBuffer, *pairParamBuffer, edges, edgeParams, colorOffsets);
+    integrator.setSprings(*pairOffsetBuffer, *pairBuffer, *pairParamBuffer);
+    integrator.resize(vertices);
+
+    initVolumesDirty = false;
+}
+
+void VolumeWorld::calcVolumes(CLBuffer<cl_float4> &positions) {
+    if (volumePartialCount) {
+        calcVolumesKernel.execute(chain, volumePartialCount * reduceGroupSize, *faceOffsetBuffer, *partialOffsetBuffer,
+                                  *groupObjectBuffer, positions, *faceBuffer, *volumePartialBuffer);
+    }
+    sumVolumesKernel.execute(chain, objects.size() * reduceGroupSize, *partialOffsetBuffer, *volumePartialBuffer, *volumeBuffer);
+}
+
+void VolumeWorld::computeForces(CLBuffer<cl_float4> &positions, CLBuffer<cl_float4> &force) {
+    calcVolumes(positions);
+
+    springs.compute(chain, vertices, positions, *inverseMassBuffer, force);
+
+    applyPressureKernel.execute(chain, vertices, *initVolumeBuffer, *volumeBuffer, *objectBuffer, positions, *cornerOffsetBuffer, *otherCornerBuffer, force);
+}
+
+void VolumeWorld::uploadInitVolumes() {
+    auto initVolumes = initVolumeBuffer->map();
+    for (size_t k = 0; k < objects.size(); ++k) {
+        initVolumes[k] = objects[k].initVolume;
+    }
+    initVolumeBuffer->unmap();
+
+    initVolumesDirty = false;
+}
+
+void VolumeWorld::collide() {
+    grid.collide(chain, vertices, *positionBuffer, *velocityBuffer, *nextPositionBuffer,
+                 *faceBuffer, *objectBuffer, *pairOffsetBuffer, *pairBuffer);
+    positionBuffer.swap(nextPositionBuffer);
+
+    integrator.invalidateForce();
+}
+
+void VolumeWorld::step(float dt) {
+    if (!vertices) {
+        return;
+    }
+
+    if (initVolumesDirty) {
+        uploadInitVolumes();
+    }
+
+    if (fused && integrator.integrator() == Integrator::Euler) {
+        calcVolumes(*positionBuffer);
+
+        stepFusedKernel.execute(chain, vertices, dt, *initVolumeBuffer, *volumeBuffer, *objectBuffer,
+                                *positionBuffer, *inverseMassBuffer, *pairOffsetBuffer, *pairBuffer, *pairParamBuffer,
+                                *cornerOffsetBuffer, *otherCornerBuffer, *velocityBuffer, *nextPositionBuffer);
+        positionBuffer.swap(nextPositionBuffer);
+
+        if (collisions) {
+            collide();
+        }
+
+        calcNormalsKernel.execute(chain, vertices, *positionBuffer, *cornerOffsetBuffer, *otherCornerBuffer, *normalBuffer);
+        return;
+    }
+
+    integrator.step(dt, chain, *positionBuffer, *velocityBuffer, *inverseMassBuffer, *forceBuffer,
+                    [this](CLBuffer<cl_float4> &positions, CLBuffer<cl_float4> &force) {
+                        computeForces(positions, force);
+                    });
+
+    if (collisions) {
+        collide();
+    }
+
+    calcNormalsKernel.execute(chain, vertices, *positionBuffer, *cornerOffsetBuffer, *otherCornerBuffer, *normalBuffer);
+}
+
+void VolumeWorld::readPositions(std::vector<cl_float4> &positions) {
+    positions.resize(vertices);
+    if (!vertices) {
+        return;
+    }
+
+    auto mapped = positionBuffer->map();
+
+    for (const auto &o : objects) {
+        for (size_t i = 0; i < o.mesh->points.size(); ++i) {
+            positions[o.vertexOffset + o.mesh->originalIndex[i]] = mapped[o.vertexOffset + i];
+        }
+    }
+
+    positionBuffer->unmap();
+}
+
+void VolumeWorld::endFrame() {
+    if (vertices) {
+        readback->enqueue({positionBuffer.get(), normalBuffer.get()}, chain);
+    }
+}
+
+void VolumeWorld::render() {
+    if (!vertices) {
+        return;
+    }
+
+    auto positions = readback->latest();
+    if (!positions) {
+        return;
+    }
+    auto normals = positions + vertices;
+
+    for (auto &o : objects) {
+        o.rendered.submit(*o.mesh, positions + o.vertexOffset, normals + o.vertexOffset);
+    }
+}
+
+void VolumeWorld::inflate(float dt) {
+    for (auto &o : objects) {
+        o.initVolume += dt * 10;
+    }
+    initVolumesDirty = true;
+    integrator.invalidateForce();
+}
+
+void VolumeWorld::deflate(float dt) {
+    for (auto &o : objects) {
+        o.initVolume -= dt * 10;
+    }
+    initVolumesDirty = true;
+    integrator.invalidateForce();
+}
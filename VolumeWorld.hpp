@@ -0,0 +1,162 @@
+#ifndef GPGPU_HF_VOLUMEWORLD_H
+#define GPGPU_HF_VOLUMEWORLD_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <CL/cl_platform.h>
+
+#include "CLBuffer.hpp"
+#include "CLKernel.hpp"
+#include "MeshData.hpp"
+#include "AbstractObject.hpp"
+#include "Integrator.hpp"
+#include "SpringForces.hpp"
+#include "CollisionGrid.hpp"
+#include "RenderedMesh.hpp"
+#include "ReadbackRing.hpp"
+
+// Any number of VolumeMesh-like objects simulated together: the vertices,
+// springs and faces of all of them are packed into one set of buffers with
+// global indices, so every kernel runs once per substep for the whole world
+// instead of once per object.
+//
+// Adding or removing an object repacks the buffers; the current positions,
+// velocities and target volumes of the other objects are kept.
+//
+// With collisions the points are kept out of the faces of every object,
+// including their own, and a new object is placed on top of the others.
+class VolumeWorld : public AbstractObject {
+    struct Object {
+        std::unique_ptr<MeshData> mesh;
+
+        // first vertex in the packed buffers
+        size_t vertexOffset = 0;
+
+        // the volume it was loaded with, changed by inflate() and deflate()
+        float initVolume = 0;
+
+        // state saved across repacks, empty until the object was simulated
+        std::vector<cl_float4> positions;
+        std::vector<cl_float4> velocities;
+
+        RenderedMesh rendered;
+    };
+
+    std::vector<Object> objects;
+    size_t vertices = 0;
+
+    // use the single stepFusedWorld kernel instead of the separate ones (Euler only)
+    bool fused = false;
+
+    // resolve contacts with the CollisionGrid after every substep
+    bool collisions = false;
+
+    // initVolumeBuffer needs an upload before the next step
+    bool initVolumesDirty = false;
+
+    std::unique_ptr<CLBuffer<cl_float4>> positionBuffer;
+    std::unique_ptr<CLBuffer<cl_float4>> nextPositionBuffer;
+    std::unique_ptr<CLBuffer<cl_float4>> velocityBuffer;
+    std::unique_ptr<CLBuffer<cl_float>> inverseMassBuffer;
+    std::unique_ptr<CLBuffer<cl_float4>> forceBuffer;
+    std::unique_ptr<CLBuffer<cl_float4>> normalBuffer;
+
+    // object of every vertex
+    std::unique_ptr<CLBuffer<cl_int>> objectBuffer;
+
+    std::unique_ptr<CLBuffer<cl_int>> pairOffsetBuffer;
+    std::unique_ptr<CLBuffer<cl_int>> pairBuffer;
+    std::unique_ptr<CLBuffer<cl_float2>> pairParamBuffer;
+
+    std::unique_ptr<CLBuffer<cl_int4>> faceBuffer;
+    std::unique_ptr<CLBuffer<cl_int>> faceOffsetBuffer;
+    std::unique_ptr<CLBuffer<cl_int>> cornerOffsetBuffer;
+    std::unique_ptr<CLBuffer<cl_int2>> otherCornerBuffer;
+
+    // per object
+    std::unique_ptr<CLBuffer<cl_float>> initVolumeBuffer;
+    std::unique_ptr<CLBuffer<cl_float>> volumeBuffer;
+
+    // the volume reduction: partial sums of REDUCE_GROUP_SIZE faces, the first
+    // partial of every object and the object of every partial
+    size_t volumePartialCount = 0;
+    std::unique_ptr<CLBuffer<cl_float>> volumePartialBuffer;
+    std::unique_ptr<CLBuffer<cl_int>> partialOffsetBuffer;
+    std::unique_ptr<CLBuffer<cl_int>> groupObjectBuffer;
+
+    // positions and normals of the last frames, on their way to render();
+    // replaced by pack() like the buffers
+    std::unique_ptr<ReadbackRing<cl_float4>> readback;
+
+    // REDUCE_GROUP_SIZE in programs.cl
+    size_t reduceGroupSize = 128;
+
+    // orders the launches of this object on an out-of-order queue
+    EventChain chain;
+
+    CLKernel<cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem> calcVolumesKernel;
+    CLKernel<cl_mem, cl_mem, cl_mem> sumVolumesKernel;
+    CLKernel<cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem> applyPressureKernel;
+    CLKernel<cl_mem, cl_mem, cl_mem, cl_mem> calcNormalsKernel;
+    CLKernel<float, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem> stepFusedKernel;
+
+    SpringForces springs;
+    TimeIntegrator integrator;
+    CollisionGrid grid;
+
+    // copies the simulated state of every packed object back to the host
+    void saveState();
+
+    // rebuilds all buffers from objects
+    void pack();
+
+    // enqueues the per-object volume reduction at the given positions into volumeBuffer
+    void calcVolumes(CLBuffer<cl_float4> &positions);
+
+    // spring and pressure forces at the given positions
+    void computeForces(CLBuffer<cl_float4> &positions, CLBuffer<cl_float4> &force);
+
+    void uploadInitVolumes();
+
+    // moves the positions into nextPositionBuffer out of contact and swaps them back
+    void collide();
+
+public:
+    VolumeWorld();
+
+    // loads the mesh and packs it after the objects already in the world
+    void add(const std::string &filename);
+
+    // packs a mesh loaded elsewhere, e.g. by a MeshLoader
+    void add(std::unique_ptr<MeshData> mesh);
+
+    void remove(size_t index);
+
+    void removeLast();
+
+    size_t objectCount() const { return objects.size(); }
+
+    void step(float dt);
+    void endFrame() override;
+    void render();
+
+    size_t vertexCount() const { return vertices; }
+
+    // all objects one after the other, each in the order of its source file
+    void readPositions(std::vector<cl_float4> &positions);
+
+    void inflate(float dt) override;
+    void deflate(float dt) override;
+
+    void setFused(bool fused) override { this->fused = fused; }
+
+    // set it before adding objects, or they may start inside each other
+    void setCollisions(bool collisions) override { this->collisions = collisions; }
+
+    void setIntegrator(Integrator integrator) override { this->integrator.setIntegrator(integrator); }
+};
+
+
+#endif //GPGPU_HF_VOLUMEWORLD_H
@@ -0,0 +1,61 @@
+#include "XPBDSolver.hpp"
+
+XPBDSolver::XPBDSolver(const MeshData &mesh):
+        n{mesh.points.size()},
+        faceCount{mesh.faces.size()},
+        volumePartialCount{(faceCount + reduceGroupSize - 1) / reduceGroupSize},
+        gradientPartialCount{(n + reduceGroupSize - 1) / reduceGroupSize},
+        colorOffsets(mesh.colorOffsets.begin(), mesh.colorOffsets.end()),
+        constraintBuffer{mesh.constraints.data(), mesh.constraints.size()},
+        constraintParamBuffer{mesh.constraintParams.data(), mesh.constraintParams.size()},
+        lambdaBuffer{mesh.constraints.size()},
+        predictedBuffer{n},
+        gradientBuffer{n},
+        volumePartialBuffer{volumePartialCount},
+        gradientPartialBuffer{gradientPartialCount},
+        scalarBuffer{2},
+        predictKernel{"xpbdPredict"},
+        distanceKernel{"xpbdDistance"},
+        calcVolumesKernel{"calcVolumes", reduceGroupSize},
+        volumeGradientKernel{"xpbdVolumeGradient", reduceGroupSize},
+        volumeLambdaKernel{"xpbdVolumeLambda", reduceGroupSize},
+        volumeApplyKernel{"xpbdVolumeApply"},
+        finishKernel{"xpbdFinish"}
+{
+}
+
+void XPBDSolver::step(float dt, float damping, float targetVolume, EventChain &chain,
+                      CLBuffer<cl_float4> &position, CLBuffer<cl_float4> &velocity, CLBuffer<cl_float> &inverseMass,
+                      CLBuffer<cl_int4> &faces, CLBuffer<cl_int> &cornerOffsets, CLBuffer<cl_int2> &otherCorners) {
+    if (!n) {
+        return;
+    }
+
+    float dt2 = dt * dt;
+
+    predictKernel.execute(chain, n, dt, inverseMass, position, velocity, predictedBuffer);
+
+    for (int k = 0; k < iterations; ++k) {
+        int firstIteration = k == 0;
+
+        for (size_t c = 0; c + 1 < colorOffsets.size(); ++c) {
+            size_t count = colorOffsets[c + 1] - colorOffsets[c];
+            if (count) {
+                distanceKernel.execute(chain, count, colorOffsets[c], firstIteration, dt2, inverseMass,
+                                       constraintBuffer, constraintParamBuffer, lambdaBuffer, predictedBuffer);
+            }
+        }
+
+        if (faceCount) {
+            calcVolumesKernel.execute(chain, faceCount, (int) faceCount, predictedBuffer, faces, volumePartialBuffer);
+            volumeGradientKernel.execute(chain, n, (int) n, inverseMass, predictedBuffer, cornerOffsets, otherCorners,
+                                         gradientBuffer, gradientPartialBuffer);
+            volumeLambdaKernel.execute(chain, reduceGroupSize, (int) volumePartialCount, volumePartialBuffer,
+                                       (int) gradientPartialCount, gradientPartialBuffer,
+                                       targetVolume, volumeCompliance / dt2, firstIteration, scalarBuffer);
+            volumeApplyKernel.execute(chain, n, scalarBuffer, inverseMass, gradientBuffer, predictedBuffer);
+        }
+    }
+
+    finishKernel.execute(chain, n, dt, damping, predictedBuffer, velocity, position);
+}
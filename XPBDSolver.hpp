@@ -0,0 +1,61 @@
+#ifndef GPGPU_HF_XPBDSOLVER_H
+#define GPGPU_HF_XPBDSOLVER_H
+
+#include <vector>
+
+#include <CL/cl_platform.h>
+
+#include "CLBuffer.hpp"
+#include "CLKernel.hpp"
+#include "MeshData.hpp"
+
+// Extended position-based dynamics for closed meshes: every edge is a distance
+// constraint and the enclosed volume a single global constraint, which takes
+// the place of the spring forces and the pressure penalty. The edges come
+// graph colored from MeshTopology, so each color is one launch without atomics
+// (see the comment above xpbdPredict in programs.cl).
+class XPBDSolver {
+    size_t n;
+    size_t faceCount;
+
+    // REDUCE_GROUP_SIZE in programs.cl
+    size_t reduceGroupSize = 128;
+    size_t volumePartialCount;
+    size_t gradientPartialCount;
+
+    std::vector<cl_int> colorOffsets;
+
+    CLBuffer<cl_int2> constraintBuffer;
+    CLBuffer<cl_float2> constraintParamBuffer;
+    CLBuffer<cl_float> lambdaBuffer;
+    CLBuffer<cl_float4> predictedBuffer;
+    CLBuffer<cl_float4> gradientBuffer;
+    CLBuffer<cl_float> volumePartialBuffer;
+    CLBuffer<cl_float> gradientPartialBuffer;
+    CLBuffer<cl_float> scalarBuffer;
+
+    CLKernel<float, cl_mem, cl_mem, cl_mem, cl_mem> predictKernel;
+    CLKernel<int, int, float, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem> distanceKernel;
+    CLKernel<int, cl_mem, cl_mem, cl_mem> calcVolumesKernel;
+    CLKernel<int, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem, cl_mem> volumeGradientKernel;
+    CLKernel<int, cl_mem, int, cl_mem, float, float, int, cl_mem> volumeLambdaKernel;
+    CLKernel<cl_mem, cl_mem, cl_mem, cl_mem> volumeApplyKernel;
+    CLKernel<float, float, cl_mem, cl_mem, cl_mem> finishKernel;
+
+public:
+    // constraint iterations per step; with XPBD a few are enough even at large steps
+    int iterations = 4;
+
+    // inverse stiffness of the volume constraint, 0 keeps the volume exactly
+    float volumeCompliance = 0;
+
+    XPBDSolver(const MeshData &mesh);
+
+    // advances position and velocity by dt, pulling the enclosed volume towards targetVolume
+    void step(float dt, float damping, float targetVolume, EventChain &chain,
+              CLBuffer<cl_float4> &position, CLBuffer<cl_float4> &velocity, CLBuffer<cl_float> &inverseMass,
+              CLBuffer<cl_int4> &faces, CLBuffer<cl_int> &cornerOffsets, CLBuffer<cl_int2> &otherCorners);
+};
+
+
+#endif //GPGPU_HF_XPBDSOLVER_H
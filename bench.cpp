@@ -0,0 +1,456 @@
+//
+// Headless benchmark: steps objects without any window or GL context.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "clwrapper.hpp"
+#include "AbstractObject.hpp"
+#include "SpringyObject.hpp"
+#include "VolumeMesh.hpp"
+#include "VolumeWorld.hpp"
+#include "NativeVolumeMesh.hpp"
+#include "ThreadPool.hpp"
+#include "Integrator.hpp"
+#include "SpringForces.hpp"
+#include "Profiler.hpp"
+
+struct BenchOptions {
+    int frames = 500;
+    int warmup = 20;
+    int substeps = 10;
+    float dt = 0.01;
+    bool springy = false;
+    bool blocking = false;
+    bool fused = false;
+    bool batched = false;
+    bool collisions = false;
+    int copies = 1;
+    Integrator integrator = Integrator::Euler;
+    bool stability = false;
+    bool native = false;
+    bool validate = false;
+    float simTime = 2;
+    const char *dump = 0;
+    const char *trace = 0;
+    bool listDevices = false;
+    DeviceSelection selection = DeviceSelection::fromEnvironment();
+    std::vector<std::string> files;
+};
+
+static void usage(const char *argv0) {
+    std::cerr << "usage: " << argv0 << " [options] objects/<name>.obj ...\n"
+            "  --frames N     measured frames per object (default 500)\n"
+            "  --warmup N     unmeasured frames before timing (default 20)\n"
+            "  --substeps N   substeps per frame (default 10)\n"
+            "  --dt X         frame timestep in seconds (default 0.01)\n"
+            "  --springy      simulate as SpringyObject instead of VolumeMesh\n"
+            "  --blocking     wait for every kernel launch (old synchronous behaviour)\n"
+            "  --out-of-order use an out-of-order queue, ordering each object's launches by events\n"
+            "  --fused        use the single-kernel VolumeMesh substep\n"
+            "  --copies N     simulate N instances of each object at once (default 1)\n"
+            "  --batched      pack the instances into one VolumeWorld instead of separate VolumeMeshes\n"
+            "  --collisions   stack the instances in a VolumeWorld with collisions (implies --batched)\n"
+            "  --integrator I euler, symplectic, verlet, rk4, implicit or xpbd (default euler)\n"
+            "  --forces M     spring forces: vertex, colored, atomic or auto (default auto, prints the timings)\n"
+            "  --backend B    opencl (default) or native, the multithreaded host VolumeMesh (euler only)\n"
+            "  --threads N    threads of the native backend (default: all hardware threads)\n"
+            "  --validate     compare the OpenCL VolumeMesh with the native one instead, step by step\n"
+            "  --stability    find the largest stable dt of every integrator instead, one step per frame\n"
+            "                 (separate objects only, not with --batched)\n"
+            "  --sim-time S   simulated seconds a dt has to survive in --stability (default 2)\n"
+            "  --no-reorder   keep the point order of the file instead of renumbering for locality\n"
+            "  --no-cache     always parse and preprocess the OBJ, ignoring <file>.meshcache\n"
+            "  --dump FILE    write the final positions as OBJ vertices, in file order\n"
+            "  --trace FILE   write a Chrome trace-event timeline of all commands (or GPGPU_HF_TRACE)\n"
+            << DeviceSelection::usage;
+}
+
+static bool parseArgs(int argc, char **argv, BenchOptions &opt) {
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (!strcmp(arg, "--frames") && hasValue) {
+            opt.frames = atoi(argv[++i]);
+        } else if (!strcmp(arg, "--warmup") && hasValue) {
+            opt.warmup = atoi(argv[++i]);
+        } else if (!strcmp(arg, "--substeps") && hasValue) {
+            opt.substeps = atoi(argv[++i]);
+        } else if (!strcmp(arg, "--dt") && hasValue) {
+            opt.dt = (float) atof(argv[++i]);
+        } else if (!strcmp(arg, "--springy")) {
+            opt.springy = true;
+        } else if (!strcmp(arg, "--blocking")) {
+            opt.blocking = true;
+        } else if (!strcmp(arg, "--out-of-order")) {
+            CLWrapper::outOfOrderQueue = true;
+        } else if (!strcmp(arg, "--fused")) {
+            opt.fused = true;
+        } else if (!strcmp(arg, "--copies") && hasValue) {
+            opt.copies = atoi(argv[++i]);
+        } else if (!strcmp(arg, "--batched")) {
+            opt.batched = true;
+        } else if (!strcmp(arg, "--collisions")) {
+            opt.collisions = true;
+            opt.batched = true;
+        } else if (!strcmp(arg, "--integrator") && hasValue && parseIntegrator(argv[i + 1], opt.integrator)) {
+            ++i;
+        } else if (!strcmp(arg, "--forces") && hasValue && parseForceMethod(argv[i + 1], SpringForces::defaultMethod)) {
+            ++i;
+        } else if (!strcmp(arg, "--backend") && hasValue &&
+                   (!strcmp(argv[i + 1], "native") || !strcmp(argv[i + 1], "opencl"))) {
+            opt.native = !strcmp(argv[++i], "native");
+        } else if (!strcmp(arg, "--threads") && hasValue) {
+            ThreadPool::defaultThreads = (size_t) std::max(1, atoi(argv[++i]));
+        } else if (!strcmp(arg, "--validate")) {
+            opt.validate = true;
+        } else if (!strcmp(arg, "--stability")) {
+            opt.stability = true;
+        } else if (!strcmp(arg, "--sim-time") && hasValue) {
+            opt.simTime = (float) atof(argv[++i]);
+        } else if (!strcmp(arg, "--no-reorder")) {
+            ObjLoader::reorderPoints = false;
+        } else if (!strcmp(arg, "--no-cache")) {
+            MeshData::useCache = false;
+        } else if (!strcmp(arg, "--dump") && hasValue) {
+            opt.dump = argv[++i];
+        } else if (!strcmp(arg, "--trace") && hasValue) {
+            opt.trace = argv[++i];
+        } else if (!strcmp(arg, "--list-devices")) {
+            opt.listDevices = true;
+        } else if (opt.selection.parseArg(i, argc, argv)) {
+            continue;
+        } else if (arg[0] == '-') {
+            return false;
+        } else {
+            opt.files.push_back(arg);
+        }
+    }
+    return opt.listDevices || (!opt.files.empty() && opt.frames > 0 && opt.substeps > 0 &&
+                                   opt.copies > 0 && !(opt.batched && (opt.springy || opt.stability)) &&
+                                   !(opt.native && (opt.springy || opt.batched || opt.stability ||
+                                                   opt.integrator != Integrator::Euler)));
+}
+
+// same work as stepAll() in main.cpp
+static void frame(const std::vector<AbstractObject *> &objects, const BenchOptions &opt) {
+    {
+        ProfileScope scope("frame");
+        {
+            ProfileScope enqueue("step");
+            for (auto o : objects) {
+                for (int i = 0; i < opt.substeps; ++i) {
+                    o->step(opt.dt / opt.substeps);
+                }
+            }
+        }
+        ProfileScope finish("clFinish");
+        if (CLWrapper::instance) {
+            clFinish(CLWrapper::instance->cqueue());
+        }
+    }
+
+    if (Profiler::instance) {
+        Profiler::instance->collect();
+    }
+}
+
+static double percentile(const std::vector<double> &sorted, double p) {
+    size_t idx = (size_t) (p / 100.0 * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(idx, sorted.size() - 1)];
+}
+
+static void dumpPositions(const std::vector<AbstractObject *> &objects, const char *path) {
+    std::ofstream f(path);
+    f << std::setprecision(9);
+
+    std::vector<cl_float4> positions;
+    for (auto o : objects) {
+        o->readPositions(positions);
+        for (const auto &p : positions) {
+            f << "v " << p.s[0] << " " << p.s[1] << " " << p.s[2] << "\n";
+        }
+    }
+}
+
+static void bench(const std::string &file, const BenchOptions &opt) {
+    typedef std::chrono::steady_clock clock;
+
+    std::vector<AbstractObject *> objects;
+    if (opt.batched) {
+        VolumeWorld *world = new VolumeWorld();
+        world->setCollisions(opt.collisions);
+        for (int c = 0; c < opt.copies; ++c) {
+            world->add(file);
+        }
+        objects.push_back(world);
+    } else {
+        for (int c = 0; c < opt.copies; ++c) {
+            if (opt.native) {
+                objects.push_back(new NativeVolumeMesh(file));
+            } else if (opt.springy) {
+                objects.push_back(new SpringyObject(file));
+            } else {
+                objects.push_back(new VolumeMesh(file));
+            }
+        }
+    }
+
+    size_t vertices = 0;
+    for (auto o : objects) {
+        o->setFused(opt.fused);
+        o->setIntegrator(opt.integrator);
+        vertices += o->vertexCount();
+    }
+
+    for (int i = 0; i < opt.warmup; ++i) {
+        frame(objects, opt);
+    }
+
+    std::vector<double> frameMs;
+    frameMs.reserve(opt.frames);
+
+    auto start = clock::now();
+    for (int i = 0; i < opt.frames; ++i) {
+        auto t1 = clock::now();
+        frame(objects, opt);
+        auto t2 = clock::now();
+        frameMs.push_back(std::chrono::duration<double, std::milli>(t2 - t1).count());
+    }
+    double total = std::chrono::duration<double>(clock::now() - start).count();
+
+    std::sort(frameMs.begin(), frameMs.end());
+
+    double steps = (double) opt.frames * opt.substeps;
+    double stepsPerSec = steps / total;
+
+    std::cout << std::fixed << std::setprecision(3)
+            << file << ": " << opt.copies << (opt.batched ? " batched" : "") << (opt.collisions ? " collisions" : "") << (opt.native ? " native" : "") << " x "
+            << vertices / opt.copies << " vertices, "
+            << opt.frames << " frames x " << opt.substeps << " substeps\n"
+            << "  steps/s:          " << stepsPerSec << "\n"
+            << "  vertex*steps/s:   " << stepsPerSec * vertices << "\n"
+            << "  frame ms p50:     " << percentile(frameMs, 50) << "\n"
+            << "  frame ms p90:     " << percentile(frameMs, 90) << "\n"
+            << "  frame ms p99:     " << percentile(frameMs, 99) << "\n"
+            << "  frame ms max:     " << frameMs.back() << std::endl;
+
+    if (opt.dump) {
+        dumpPositions(objects, opt.dump);
+    }
+
+    for (auto o : objects) {
+        delete o;
+    }
+}
+
+static AbstractObject *createObject(const std::string &file, const BenchOptions &opt) {
+    if (opt.springy) {
+        return new SpringyObject(file);
+    }
+    return new VolumeMesh(file);
+}
+
+// bounding box diagonal, infinite if any coordinate is not finite
+static double extent(const std::vector<cl_float4> &positions) {
+    double lo[3] = {INFINITY, INFINITY, INFINITY};
+    double hi[3] = {-INFINITY, -INFINITY, -INFINITY};
+    for (const auto &p : positions) {
+        for (int k = 0; k < 3; ++k) {
+            if (!std::isfinite(p.s[k])) {
+                return INFINITY;
+            }
+            lo[k] = std::min(lo[k], (double) p.s[k]);
+            hi[k] = std::max(hi[k], (double) p.s[k]);
+        }
+    }
+    return std::sqrt((hi[0] - lo[0]) * (hi[0] - lo[0]) + (hi[1] - lo[1]) * (hi[1] - lo[1]) +
+                     (hi[2] - lo[2]) * (hi[2] - lo[2]));
+}
+
+// Steps a fresh object for opt.simTime seconds with single steps of dt. It
+// counts as stable if no coordinate became NaN or infinite and it never grew
+// beyond four times its original size.
+static bool survives(const std::string &file, Integrator integrator, float dt, const BenchOptions &opt) {
+    std::unique_ptr<AbstractObject> o(createObject(file, opt));
+    o->setIntegrator(integrator);
+
+    std::vector<cl_float4> positions;
+    o->readPositions(positions);
+    double limit = 4 * extent(positions);
+
+    long steps = (long) std::ceil(opt.simTime / dt);
+    long checkEvery = std::max(1L, steps / 20);
+    for (long i = 0; i < steps; ++i) {
+        o->step(dt);
+
+        if ((i + 1) % checkEvery == 0 || i + 1 == steps) {
+            o->readPositions(positions);
+            if (!(extent(positions) < limit)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void stability(const std::string &file, const BenchOptions &opt) {
+    typedef std::chrono::steady_clock clock;
+
+    const float minDt = 1e-5f, maxDt = 0.1f;
+
+    std::cout << std::fixed << file << ": largest stable dt over " << opt.simTime << " s simulated\n"
+            << "  integrator    stable dt     steps/s   simulated s/s\n";
+
+    for (int m = 0; m < integratorCount; ++m) {
+        Integrator integrator = (Integrator) m;
+
+        // only volume meshes have a position-based solver
+        if (integrator == Integrator::XPBD && opt.springy) {
+            continue;
+        }
+
+        // double until the first failure, then bisect on a log scale
+        float good = 0, bad = 0;
+        for (float dt = minDt; dt <= maxDt; dt *= 2) {
+            if (!survives(file, integrator, dt, opt)) {
+                bad = dt;
+                break;
+            }
+            good = dt;
+        }
+        if (good > 0 && bad > 0) {
+            for (int i = 0; i < 6; ++i) {
+                float mid = std::sqrt(good * bad);
+                (survives(file, integrator, mid, opt) ? good : bad) = mid;
+            }
+        }
+
+        std::cout << "  " << std::setw(12) << std::left << integratorName(integrator) << std::right;
+        if (good == 0) {
+            std::cout << "  < " << std::scientific << std::setprecision(1) << minDt << std::fixed << "\n";
+            continue;
+        }
+
+        std::unique_ptr<AbstractObject> o(createObject(file, opt));
+        o->setIntegrator(integrator);
+
+        auto start = clock::now();
+        for (int i = 0; i < opt.frames; ++i) {
+            o->step(good);
+        }
+        clFinish(CLWrapper::instance->cqueue());
+        double total = std::chrono::duration<double>(clock::now() - start).count();
+        double stepsPerSec = opt.frames / total;
+
+        std::cout << (bad == 0 ? "  >=" : "    ") << std::setw(10) << std::setprecision(6) << good
+                << std::setw(12) << std::setprecision(1) << stepsPerSec
+                << std::setw(16) << std::setprecision(3) << stepsPerSec * good << "\n";
+    }
+    std::cout.flush();
+}
+
+// Steps the OpenCL VolumeMesh and the native one side by side with the Euler
+// integrator and reports how far apart their points get. Rounding (and FMA)
+// differences grow slowly; a wrong kernel shows up within a few frames.
+static bool validate(const std::string &file, const BenchOptions &opt) {
+    VolumeMesh device(file);
+    NativeVolumeMesh native(file);
+    device.setFused(opt.fused);
+
+    std::vector<cl_float4> a, b;
+    native.readPositions(b);
+    double size = extent(b);
+
+    const double tolerance = 1e-2;
+    double worst = 0;
+    int worstFrame = 0;
+    int reportEvery = std::max(1, opt.frames / 10);
+
+    std::cout << std::scientific << std::setprecision(3)
+            << file << ": OpenCL against native, " << opt.frames << " frames x " << opt.substeps << " substeps\n"
+            << "     frame   max deviation   relative\n";
+
+    for (int frame = 1; frame <= opt.frames; ++frame) {
+        for (int i = 0; i < opt.substeps; ++i) {
+            device.step(opt.dt / opt.substeps);
+            native.step(opt.dt / opt.substeps);
+        }
+
+        device.readPositions(a);
+        native.readPositions(b);
+
+        double deviation = 0;
+        for (size_t i = 0; i < a.size(); ++i) {
+            for (int k = 0; k < 3; ++k) {
+                double d = std::fabs((double) a[i].s[k] - b[i].s[k]);
+                deviation = std::isfinite(d) ? std::max(deviation, d) : INFINITY;
+            }
+        }
+        if (deviation >= worst) {
+            worst = deviation;
+            worstFrame = frame;
+        }
+
+        if (frame % reportEvery == 0 || frame == opt.frames) {
+            std::cout << std::setw(10) << frame << std::setw(16) << deviation << std::setw(11) << deviation / size << "\n";
+        }
+    }
+
+    bool ok = worst / size < tolerance;
+    std::cout << "  " << (ok ? "OK" : "FAILED") << ", largest deviation " << worst / size
+            << " of the object size at frame " << worstFrame << std::endl;
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    BenchOptions opt;
+    if (!parseArgs(argc, argv, opt)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (opt.listDevices) {
+        CLWrapper::listDevices();
+        return EXIT_SUCCESS;
+    }
+
+    Profiler profiler(opt.trace ? opt.trace : getenv("GPGPU_HF_TRACE"));
+
+    // the native backend alone needs no OpenCL device at all
+    std::unique_ptr<CLWrapper> cl;
+    if (!opt.native || opt.validate) {
+        cl.reset(new CLWrapper(opt.selection));
+        if (opt.blocking) {
+            cl->setBlockingLaunches(true);
+        }
+    }
+
+    bool valid = true;
+    for (const auto &file : opt.files) {
+        if (opt.validate) {
+            valid = validate(file, opt) && valid;
+        } else if (opt.stability) {
+            stability(file, opt);
+        } else {
+            bench(file, opt);
+        }
+    }
+
+    if (Profiler::instance) {
+        Profiler::instance->write();
+    }
+
+    return valid ? EXIT_SUCCESS : EXIT_FAILURE;
+}
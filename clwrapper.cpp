@@ -19,16 +19,35 @@
  */
 
 #include "clwrapper.hpp"
+#include "Profiler.hpp"
+
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
 
 CLWrapper *CLWrapper::instance = 0;
 
-CLWrapper::CLWrapper(cl_device_type device_type) : _device_type(device_type) {
+bool CLWrapper::outOfOrderQueue = false;
+int CLWrapper::readbackLatency = 1;
+
+CLWrapper::CLWrapper(const DeviceSelection &selection) {
     if (instance) {
         throw "Only one instance plz!";
     }
 
-    createPlatform();
-    createDevice();
+    const char *blocking = getenv("GPGPU_HF_BLOCKING");
+    _blocking_launches = blocking && strcmp(blocking, "0");
+
+    const char *outOfOrder = getenv("GPGPU_HF_OUT_OF_ORDER");
+    _out_of_order = outOfOrderQueue || (outOfOrder && strcmp(outOfOrder, "0"));
+
+    selectDevice(selection);
     createContext();
     createCommandQueue();
 
@@ -55,10 +74,6 @@ char *CLWrapper::getPlatformInfo(cl_platform_info paramName) {
     return info;
 }
 
-void CLWrapper::createPlatform() {
-    CL_SAFE_CALL(clGetPlatformIDs(1, &_platform, NULL));
-}
-
 void *CLWrapper::getDeviceInfo(cl_device_info paramName) {
     size_t infoSize = 0;
     CL_SAFE_CALL(clGetDeviceInfo(_device_id, paramName, 0, NULL, &infoSize));
@@ -67,8 +82,203 @@ void *CLWrapper::getDeviceInfo(cl_device_info paramName) {
     return info;
 }
 
-void CLWrapper::createDevice() {
-    CL_SAFE_CALL(clGetDeviceIDs(_platform, _device_type, 1, &_device_id, NULL));
+const char *DeviceSelection::usage =
+        "  --platform P       OpenCL platform index or name substring (or GPGPU_HF_PLATFORM)\n"
+        "  --device D         device index within its platform or name substring (or GPGPU_HF_DEVICE)\n"
+        "  --device-type T    gpu, cpu, accelerator or all (or GPGPU_HF_DEVICE_TYPE)\n"
+        "  --list-devices     print the available platforms and devices and exit\n";
+
+DeviceSelection DeviceSelection::fromEnvironment() {
+    DeviceSelection selection;
+    const char *platform = getenv("GPGPU_HF_PLATFORM");
+    const char *device = getenv("GPGPU_HF_DEVICE");
+    const char *type = getenv("GPGPU_HF_DEVICE_TYPE");
+    selection.platform = platform ? platform : "";
+    selection.device = device ? device : "";
+    selection.type = type ? type : "";
+    return selection;
+}
+
+bool DeviceSelection::parseArg(int &i, int argc, char **argv) {
+    if (i + 1 >= argc) {
+        return false;
+    }
+
+    if (!strcmp(argv[i], "--platform")) {
+        platform = argv[++i];
+    } else if (!strcmp(argv[i], "--device")) {
+        device = argv[++i];
+    } else if (!strcmp(argv[i], "--device-type")) {
+        type = argv[++i];
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// a string property of a platform (getInfo = clGetPlatformInfo) or a device (clGetDeviceInfo)
+template<typename Id, typename GetInfo>
+static std::string infoString(GetInfo getInfo, Id id, cl_uint paramName) {
+    size_t infoSize = 0;
+    if (getInfo(id, paramName, 0, NULL, &infoSize) != CL_SUCCESS) {
+        return std::string();
+    }
+    std::string info(infoSize, 0);
+    getInfo(id, paramName, infoSize, &info[0], NULL);
+    return info.c_str();
+}
+
+static std::string platformName(cl_platform_id platform, cl_platform_info paramName) {
+    return infoString(clGetPlatformInfo, platform, paramName);
+}
+
+static std::string deviceName(cl_device_id device, cl_device_info paramName) {
+    return infoString(clGetDeviceInfo, device, paramName);
+}
+
+template<typename T>
+static T deviceValue(cl_device_id device, cl_device_info paramName) {
+    T value = 0;
+    clGetDeviceInfo(device, paramName, sizeof(T), &value, NULL);
+    return value;
+}
+
+static std::vector<cl_platform_id> platformIDs() {
+    cl_uint count = 0;
+    if (clGetPlatformIDs(0, NULL, &count) != CL_SUCCESS || !count) {
+        return std::vector<cl_platform_id>();
+    }
+    std::vector<cl_platform_id> platforms(count);
+    clGetPlatformIDs(count, platforms.data(), NULL);
+    return platforms;
+}
+
+static std::vector<cl_device_id> deviceIDs(cl_platform_id platform) {
+    cl_uint count = 0;
+    if (clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, 0, NULL, &count) != CL_SUCCESS || !count) {
+        return std::vector<cl_device_id>();
+    }
+    std::vector<cl_device_id> devices(count);
+    clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, count, devices.data(), NULL);
+    return devices;
+}
+
+static const char *deviceTypeName(cl_device_type type) {
+    if (type & CL_DEVICE_TYPE_GPU) return "GPU";
+    if (type & CL_DEVICE_TYPE_CPU) return "CPU";
+    if (type & CL_DEVICE_TYPE_ACCELERATOR) return "accelerator";
+    return "other";
+}
+
+// expected relative throughput, only used to order the candidates
+static double deviceScore(cl_device_id device) {
+    return (double) deviceValue<cl_uint>(device, CL_DEVICE_MAX_COMPUTE_UNITS) *
+           deviceValue<cl_uint>(device, CL_DEVICE_MAX_CLOCK_FREQUENCY);
+}
+
+// an all-digits selector is an index, anything else a case insensitive name substring
+static bool selectorMatches(const std::string &selector, size_t index, const std::string &name) {
+    if (selector.empty()) {
+        return true;
+    }
+    if (selector.find_first_not_of("0123456789") == std::string::npos) {
+        return (size_t) atoi(selector.c_str()) == index;
+    }
+
+    std::string lowerName = name, lowerSelector = selector;
+    for (auto &c : lowerName) c = (char) tolower((unsigned char) c);
+    for (auto &c : lowerSelector) c = (char) tolower((unsigned char) c);
+    return lowerName.find(lowerSelector) != std::string::npos;
+}
+
+static bool parseDeviceType(const std::string &name, cl_device_type &type) {
+    std::string lower = name;
+    for (auto &c : lower) c = (char) tolower((unsigned char) c);
+
+    if (lower.empty() || lower == "all") {
+        type = CL_DEVICE_TYPE_ALL;
+    } else if (lower == "gpu") {
+        type = CL_DEVICE_TYPE_GPU;
+    } else if (lower == "cpu") {
+        type = CL_DEVICE_TYPE_CPU;
+    } else if (lower == "accelerator") {
+        type = CL_DEVICE_TYPE_ACCELERATOR;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void CLWrapper::selectDevice(const DeviceSelection &selection) {
+    cl_device_type type;
+    if (!parseDeviceType(selection.type, type)) {
+        std::cerr << "Unknown device type: " << selection.type << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    bool found = false;
+    double bestScore = 0;
+
+    std::vector<cl_platform_id> platforms = platformIDs();
+    for (size_t p = 0; p < platforms.size(); ++p) {
+        if (!selectorMatches(selection.platform, p, platformName(platforms[p], CL_PLATFORM_NAME))) {
+            continue;
+        }
+
+        std::vector<cl_device_id> devices = deviceIDs(platforms[p]);
+        for (size_t d = 0; d < devices.size(); ++d) {
+            if (!(deviceValue<cl_device_type>(devices[d], CL_DEVICE_TYPE) & type) ||
+                !selectorMatches(selection.device, d, deviceName(devices[d], CL_DEVICE_NAME))) {
+                continue;
+            }
+
+            double score = deviceScore(devices[d]);
+            if (!found || score > bestScore) {
+                _platform = platforms[p];
+                _device_id = devices[d];
+                bestScore = score;
+                found = true;
+            }
+        }
+    }
+
+    if (!found) {
+        std::cerr << "No OpenCL device matches platform \"" << selection.platform << "\", device \""
+                  << selection.device << "\", type \"" << selection.type << "\"" << std::endl;
+        listDevices();
+        exit(EXIT_FAILURE);
+    }
+}
+
+void CLWrapper::listDevices() {
+    std::vector<cl_platform_id> platforms = platformIDs();
+    if (platforms.empty()) {
+        std::cout << "No OpenCL platforms found" << std::endl;
+        return;
+    }
+
+    for (size_t p = 0; p < platforms.size(); ++p) {
+        std::cout << "platform " << p << ": " << platformName(platforms[p], CL_PLATFORM_NAME)
+                  << " (" << platformName(platforms[p], CL_PLATFORM_VENDOR) << ", "
+                  << platformName(platforms[p], CL_PLATFORM_VERSION) << ")\n";
+
+        std::vector<cl_device_id> devices = deviceIDs(platforms[p]);
+        for (size_t d = 0; d < devices.size(); ++d) {
+            cl_device_id device = devices[d];
+            std::cout << "  device " << d << ": " << deviceName(device, CL_DEVICE_NAME)
+                      << " [" << deviceTypeName(deviceValue<cl_device_type>(device, CL_DEVICE_TYPE)) << "]\n"
+                      << "    " << deviceName(device, CL_DEVICE_VERSION)
+                      << ", driver " << deviceName(device, CL_DRIVER_VERSION) << "\n"
+                      << "    compute units: " << deviceValue<cl_uint>(device, CL_DEVICE_MAX_COMPUTE_UNITS)
+                      << ", clock: " << deviceValue<cl_uint>(device, CL_DEVICE_MAX_CLOCK_FREQUENCY) << " MHz"
+                      << ", max work-group: " << deviceValue<size_t>(device, CL_DEVICE_MAX_WORK_GROUP_SIZE) << "\n"
+                      << "    global memory: " << (deviceValue<cl_ulong>(device, CL_DEVICE_GLOBAL_MEM_SIZE) >> 20) << " MiB"
+                      << ", max allocation: " << (deviceValue<cl_ulong>(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE) >> 20) << " MiB"
+                      << ", local memory: " << (deviceValue<cl_ulong>(device, CL_DEVICE_LOCAL_MEM_SIZE) >> 10) << " KiB\n"
+                      << "    score (compute units x MHz): " << deviceScore(device) << "\n";
+        }
+    }
+    std::cout.flush();
 }
 
 void CLWrapper::createContext() {
@@ -80,14 +290,37 @@ void CLWrapper::createContext() {
 }
 
 void CLWrapper::createCommandQueue() {
-    _cqueue = clCreateCommandQueue(_context, _device_id, 0, NULL);
+    // command timestamps are only available from a profiling queue
+    cl_command_queue_properties properties = Profiler::instance ? CL_QUEUE_PROFILING_ENABLE : 0;
+
+    if (_out_of_order) {
+        cl_command_queue_properties supported = 0;
+        clGetDeviceInfo(_device_id, CL_DEVICE_QUEUE_PROPERTIES, sizeof(supported), &supported, NULL);
+        if (supported & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE) {
+            properties |= CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE;
+        } else {
+            std::cerr << "Out-of-order queues are not supported by the device, using an in-order one" << std::endl;
+            _out_of_order = false;
+        }
+    }
+
+    _cqueue = clCreateCommandQueue(_context, _device_id, properties, NULL);
     if (!_cqueue) {
         std::cerr << "Command queue creation failed!" << std::endl;
     }
 }
 
+void CLWrapper::enqueueBarrier() {
+#ifdef CL_VERSION_1_2
+    clEnqueueBarrierWithWaitList(_cqueue, 0, NULL, NULL);
+#else
+    clEnqueueBarrier(_cqueue);
+#endif
+}
+
 void CLWrapper::printOpenCLInfo() {
     std::cout << getPlatformInfo(CL_PLATFORM_VERSION) << std::endl;
+    std::cout << "Device: " << deviceString(CL_DEVICE_NAME) << std::endl;
 
     cl_uint *max_compute_units = (cl_uint *) getDeviceInfo(CL_DEVICE_MAX_COMPUTE_UNITS);
     std::cout << "Max compute units: " << *max_compute_units << std::endl;
@@ -107,7 +340,108 @@ bool CLWrapper::fileToString(const char *path, char *&out, int &len) {
     return true;
 }
 
-cl_program CLWrapper::createProgram(const char *fileName) {
+std::string CLWrapper::platformString(cl_platform_info paramName) {
+    return platformName(_platform, paramName);
+}
+
+std::string CLWrapper::deviceString(cl_device_info paramName) {
+    return deviceName(_device_id, paramName);
+}
+
+// Binaries are cached per user, named after a hash of everything that may
+// change the compiled code: source, options, platform, device and driver.
+std::string CLWrapper::binaryCachePath(const char *source, const char *options) {
+    const char *disabled = getenv("GPGPU_HF_NO_BINARY_CACHE");
+    if (disabled && strcmp(disabled, "0")) {
+        return std::string();
+    }
+
+    std::string dir;
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    if (xdg && *xdg) {
+        dir = xdg;
+    } else if (home && *home) {
+        dir = std::string(home) + "/.cache";
+    } else {
+        return std::string();
+    }
+    mkdir(dir.c_str(), 0755);
+    dir += "/gpgpu_hf";
+    mkdir(dir.c_str(), 0755);
+
+    std::string key = std::string(source) + '\0' + options + '\0' +
+                      platformString(CL_PLATFORM_NAME) + '\0' + platformString(CL_PLATFORM_VERSION) + '\0' +
+                      deviceString(CL_DEVICE_NAME) + '\0' + deviceString(CL_DRIVER_VERSION);
+
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : key) {
+        hash = (hash ^ (unsigned char) c) * 1099511628211ull;
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.clbin", (unsigned long long) hash);
+    return dir + name;
+}
+
+cl_program CLWrapper::loadProgramBinary(const std::string &path, const char *options) {
+    std::ifstream file(path, std::ios::ate | std::ios::binary);
+    if (!file.is_open()) {
+        return 0;
+    }
+    size_t size = file.tellg();
+    std::vector<unsigned char> binary(size);
+    file.seekg(0, std::ios::beg);
+    file.read((char *) binary.data(), size);
+    if (!file || size == 0) {
+        return 0;
+    }
+
+    const unsigned char *binaries[] = {binary.data()};
+    cl_int status, err;
+    cl_program program = clCreateProgramWithBinary(_context, 1, &_device_id, &size, binaries, &status, &err);
+    if (!program || err != CL_SUCCESS || status != CL_SUCCESS) {
+        if (program) {
+            clReleaseProgram(program);
+        }
+        return 0;
+    }
+
+    if (clBuildProgram(program, 1, &_device_id, options, NULL, NULL) != CL_SUCCESS) {
+        clReleaseProgram(program);
+        return 0;
+    }
+
+    return program;
+}
+
+void CLWrapper::saveProgramBinary(cl_program program, const std::string &path) {
+    size_t size = 0;
+    if (clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size), &size, NULL) != CL_SUCCESS || !size) {
+        return;
+    }
+
+    std::vector<unsigned char> binary(size);
+    unsigned char *binaries[] = {binary.data()};
+    if (clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(binaries), binaries, NULL) != CL_SUCCESS) {
+        return;
+    }
+
+    // written under a unique name and renamed, so a concurrent start never reads half a binary
+    std::string tmp = path + ".XXXXXX";
+    int fd = mkstemp(&tmp[0]);
+    if (fd < 0) {
+        return;
+    }
+    bool ok = write(fd, binary.data(), size) == (ssize_t) size;
+    ok = (close(fd) == 0) && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        unlink(tmp.c_str());
+    }
+}
+
+cl_program CLWrapper::createProgram(const char *fileName, const char *options) {
     char *programSource = NULL;
     int len = 0;
 
@@ -115,9 +449,21 @@ cl_program CLWrapper::createProgram(const char *fileName) {
         std::cerr << "Error loading program: " << fileName << std::endl;
         exit(EXIT_FAILURE);
     }
+
+    std::string cachePath = binaryCachePath(programSource, options);
+    if (!cachePath.empty()) {
+        cl_program cached = loadProgramBinary(cachePath, options);
+        if (cached) {
+            std::cerr << "Program loaded from binary cache " << cachePath << std::endl;
+            delete[] programSource;
+            return cached;
+        }
+    }
+
     cl_program program = 0;
     cl_int err;
     program = clCreateProgramWithSource(_context, 1, (const char **) &programSource, NULL, &err);
+    delete[] programSource;
     if (!program) {
         std::cerr << "Error: Failed to create compute program!" << std::endl;
         switch (err) {
@@ -135,7 +481,7 @@ cl_program CLWrapper::createProgram(const char *fileName) {
         exit(EXIT_FAILURE);
     }
 
-    err = clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
+    err = clBuildProgram(program, 0, NULL, options, NULL, NULL);
 
     size_t msglen;
     char buffer[2048];
@@ -145,6 +491,10 @@ cl_program CLWrapper::createProgram(const char *fileName) {
                           sizeof(buffer), buffer, &msglen);
     std::cerr << buffer << std::endl;
 
+    if (err == CL_SUCCESS && !cachePath.empty()) {
+        saveProgramBinary(program, cachePath);
+    }
+
     return program;
 }
 
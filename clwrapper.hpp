@@ -23,6 +23,7 @@
 
 #include <iostream>
 #include <fstream>
+#include <string>
 
 #include <CL/opencl.h>
 #include <CL/cl_platform.h>
@@ -34,9 +35,28 @@
       exit(EXIT_FAILURE);                        \
     } }
 
+// Which OpenCL device to run on. Platform and device are given by index (as
+// printed by CLWrapper::listDevices()) or by a case insensitive name
+// substring; empty fields match everything. Among the matching devices the
+// one with the most compute units x clock is used.
+struct DeviceSelection {
+    std::string platform;
+    std::string device;
+    std::string type;   // gpu, cpu, accelerator or all
+
+    // GPGPU_HF_PLATFORM, GPGPU_HF_DEVICE and GPGPU_HF_DEVICE_TYPE
+    static DeviceSelection fromEnvironment();
+
+    // consumes --platform, --device or --device-type with its value at argv[i];
+    // returns false if argv[i] is none of those
+    bool parseArg(int &i, int argc, char **argv);
+
+    static const char *usage;
+};
+
 class CLWrapper {
 public:
-    CLWrapper(cl_device_type _device_type = CL_DEVICE_TYPE_GPU);
+    CLWrapper(const DeviceSelection &selection = DeviceSelection::fromEnvironment());
 
     ~CLWrapper();
 
@@ -50,35 +70,70 @@ public:
 
     cl_program program() { return _program; }
 
+    // when false (the default) kernel launches and unmaps return right after
+    // enqueueing, and the in-order queue orders them; the host only waits in
+    // map(), clFinish() or on an explicit event
+    bool blockingLaunches() { return _blocking_launches; }
+
+    void setBlockingLaunches(bool blocking) { _blocking_launches = blocking; }
+
+    // set before construction (or GPGPU_HF_OUT_OF_ORDER=1) to ask for an
+    // out-of-order queue; commands then only wait for their event chain
+    static bool outOfOrderQueue;
+
+    // frames the positions drawn may lag behind the simulation (ReadbackRing);
+    // 0 waits for the copy of every frame before drawing it
+    static int readbackLatency;
+
+    // whether the queue actually is out-of-order (the device may not support it)
+    bool outOfOrder() { return _out_of_order; }
+
+    // makes every later command wait for all earlier ones; needed around host
+    // access on an out-of-order queue
+    void enqueueBarrier();
+
     char *getPlatformInfo(cl_platform_info paramName);
 
     void *getDeviceInfo(cl_device_info paramName);
 
-    cl_program createProgram(const char *fileName);
+    // built programs are cached on disk as binaries, see binaryCachePath()
+    cl_program createProgram(const char *fileName, const char *options = "");
 
     cl_kernel createKernel(cl_program program, const char *kernelName);
 
     void printOpenCLInfo();
 
+    // prints every platform and device with the properties used for selection
+    static void listDevices();
+
     static const char *getErrorString(cl_int error);
 
 private:
-    cl_device_type _device_type;
     cl_platform_id _platform;
     cl_device_id _device_id;
     cl_context _context;
     cl_command_queue _cqueue;
     cl_program _program;
+    bool _blocking_launches;
+    bool _out_of_order;
 
-    void createPlatform();
-
-    void createDevice();
+    void selectDevice(const DeviceSelection &selection);
 
     void createContext();
 
     void createCommandQueue();
 
     bool fileToString(const char *path, char *&out, int &len);
+
+    std::string platformString(cl_platform_info paramName);
+
+    std::string deviceString(cl_device_info paramName);
+
+    std::string binaryCachePath(const char *source, const char *options);
+
+    cl_program loadProgramBinary(const std::string &path, const char *options);
+
+    void saveProgramBinary(cl_program program, const std::string &path);
 };
 
 #endif
@@ -1,35 +1,131 @@
 
 __constant float4 gravity = (float4)(0, 0, -10, 0);
 
+// work-group size of the reduction kernels, must match reduceGroupSize on the host
+#define REDUCE_GROUP_SIZE 128
 
-__kernel void calcForces(int maxDegree,
+// sums scratch[] of a whole work-group into scratch[0]
+void reduceLocal(__local float *scratch) {
+    int lid = get_local_id(0);
+    for (int offset = REDUCE_GROUP_SIZE / 2; offset > 0; offset /= 2) {
+        barrier(CLK_LOCAL_MEM_FENCE);
+        if (lid < offset) {
+            scratch[lid] += scratch[lid + offset];
+        }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+}
+
+
+// springs of a point are pairBuffer[pairOffsetBuffer[point] .. pairOffsetBuffer[point + 1])
+__kernel void calcForces(
         __global float4 *positionBuffer,
         __global float *inverseMassBuffer,
-        __global int *degreeBuffer,
+        __global int *pairOffsetBuffer,
         __global int *pairBuffer,
         __global float2 *pairParamBuffer,
         __global float4 *forceBuffer)
 {
         int point = get_global_id(0);
-        int first = point * maxDegree;
+        int first = pairOffsetBuffer[point];
+        int last = pairOffsetBuffer[point + 1];
+
+        float4 position = positionBuffer[point];
 
         float invMass = inverseMassBuffer[point];
         if (invMass > 1e-5f) {
             forceBuffer[point] = gravity / invMass;
         }
-        for (int i = 0; i < degreeBuffer[point]; ++i) {
-                int other = pairBuffer[first + i];
+        for (int i = first; i < last; ++i) {
+                float4 other = positionBuffer[pairBuffer[i]];
 
-                float dist = distance(positionBuffer[other], positionBuffer[point]);
+                float dist = distance(other, position);
 
                 if (dist < 1e-5f) continue;
 
-                float4 to_other = (positionBuffer[other] - positionBuffer[point]) / dist;
+                float4 to_other = (other - position) / dist;
 
-                forceBuffer[point] += to_other * pairParamBuffer[first + i].y * (dist - pairParamBuffer[first + i].x);
+                forceBuffer[point] += to_other * pairParamBuffer[i].y * (dist - pairParamBuffer[i].x);
         }
 }
 
+// The edge-parallel variants below evaluate every spring once, on the unique
+// edges of MeshTopology: rest length and compliance, whose inverse is the
+// summed strength of the springs merged into the edge. initForces writes the
+// gravity they add to.
+
+__kernel void initForces(
+        __global float *inverseMassBuffer,
+        __global float4 *forceBuffer) {
+    int point = get_global_id(0);
+
+    float invMass = inverseMassBuffer[point];
+    forceBuffer[point] = invMass > 1e-5f ? gravity / invMass : (float4)(0);
+}
+
+// force on the first end of an edge, the second gets the opposite
+float4 edgeForce(__global float4 *positionBuffer, int2 ends, float2 params) {
+    float4 a = positionBuffer[ends.x];
+    float4 b = positionBuffer[ends.y];
+
+    float dist = distance(a, b);
+    if (dist < 1e-5f) {
+        return (float4)(0);
+    }
+
+    return (b - a) / dist * (dist - params.x) / params.y;
+}
+
+// edges first .. first + global size, all of one color, so no two work-items
+// touch the same point
+__kernel void calcForcesColored(int first,
+        __global float4 *positionBuffer,
+        __global int2 *edgeBuffer,
+        __global float2 *edgeParamBuffer,
+        __global float4 *forceBuffer) {
+    int k = first + get_global_id(0);
+    int2 ends = edgeBuffer[k];
+
+    float4 force = edgeForce(positionBuffer, ends, edgeParamBuffer[k]);
+
+    forceBuffer[ends.x] += force;
+    forceBuffer[ends.y] -= force;
+}
+
+// OpenCL 1.x has no float atomics, but 32 bit compare-and-swap is core since 1.1
+void atomicAddFloat(volatile __global float *address, float value) {
+    volatile __global unsigned int *word = (volatile __global unsigned int *) address;
+
+    unsigned int old = *word;
+    unsigned int seen;
+    while ((seen = atomic_cmpxchg(word, old, as_uint(as_float(old) + value))) != old) {
+        old = seen;
+    }
+}
+
+void atomicAddForce(__global float4 *forceBuffer, int point, float4 force) {
+    volatile __global float *f = (volatile __global float *) (forceBuffer + point);
+
+    atomicAddFloat(f, force.x);
+    atomicAddFloat(f + 1, force.y);
+    atomicAddFloat(f + 2, force.z);
+}
+
+// all edges in one launch
+__kernel void calcForcesAtomic(
+        __global float4 *positionBuffer,
+        __global int2 *edgeBuffer,
+        __global float2 *edgeParamBuffer,
+        __global float4 *forceBuffer) {
+    int k = get_global_id(0);
+    int2 ends = edgeBuffer[k];
+
+    float4 force = edgeForce(positionBuffer, ends, edgeParamBuffer[k]);
+
+    atomicAddForce(forceBuffer, ends.x, force);
+    atomicAddForce(forceBuffer, ends.y, -force);
+}
+
 __kernel void integrate1Euler(
         float dt,
         __global float *invmass_in,
@@ -40,6 +136,16 @@ __kernel void integrate1Euler(
     velocity_out[id] = velocity_in[id] + dt * force_in[id] * invmass_in[id];
 }
 
+// the tilted ground plane z = -0.3 x: a point below it is put back onto it,
+// loses the z component of its velocity and half of the rest
+void collidePlane(float4 *position, float4 *velocity) {
+    if ((position->z < -position->x * 0.3f)) {
+        position->z = -position->x * 0.3f;
+        velocity->z = 0.0f;
+        *velocity *= 0.5f;
+    }
+}
+
 __kernel void integrate2Euler(
         float dt,
         __global float4 *position_in,
@@ -47,55 +153,205 @@ __kernel void integrate2Euler(
         __global float4 *position_out) {
     int id = get_global_id(0);
 
-    position_out[id] = position_in[id] + dt * velocity_in[id];
+    float4 position = position_in[id] + dt * velocity_in[id];
+    float4 velocity = velocity_in[id];
 
-    if ((position_out[id].z < -position_out[id].x * 0.3f)) {
-        position_out[id].z = -position_out[id].x * 0.3f;
-        velocity_in[id].z = 0.0f;
-        velocity_in[id] *= 0.5f;
-    }
-    velocity_in[id] *= 0.999f;
+    collidePlane(&position, &velocity);
+
+    velocity_in[id] = velocity * 0.999f;
+    position_out[id] = position;
+}
+
+
+// The integrators below take their velocity damping as a factor per step,
+// exp(-rate * dt), computed on the host, so it does not depend on the step size.
+
+// semi-implicit Euler: new velocity first, then the position with it
+__kernel void integrateSymplecticEuler(float dt, float damping,
+        __global float *inverseMassBuffer,
+        __global float4 *forceBuffer,
+        __global float4 *velocityBuffer,
+        __global float4 *positionBuffer) {
+    int id = get_global_id(0);
+
+    float4 velocity = (velocityBuffer[id] + dt * forceBuffer[id] * inverseMassBuffer[id]) * damping;
+    float4 position = positionBuffer[id] + dt * velocity;
+
+    collidePlane(&position, &velocity);
+
+    velocityBuffer[id] = velocity;
+    positionBuffer[id] = position;
+}
+
+// velocity Verlet, first half: positions from the force at the old positions
+__kernel void verletPositions(float dt,
+        __global float *inverseMassBuffer,
+        __global float4 *forceBuffer,
+        __global float4 *velocityBuffer,
+        __global float4 *positionBuffer) {
+    int id = get_global_id(0);
+
+    float4 velocity = velocityBuffer[id];
+    float4 position = positionBuffer[id] + dt * velocity + 0.5f * dt * dt * forceBuffer[id] * inverseMassBuffer[id];
+
+    collidePlane(&position, &velocity);
+
+    velocityBuffer[id] = velocity;
+    positionBuffer[id] = position;
 }
 
+// velocity Verlet, second half: velocities from the old and the new force
+__kernel void verletVelocities(float dt, float damping,
+        __global float *inverseMassBuffer,
+        __global float4 *forceBuffer,
+        __global float4 *nextForceBuffer,
+        __global float4 *velocityBuffer) {
+    int id = get_global_id(0);
+
+    float4 acceleration = 0.5f * (forceBuffer[id] + nextForceBuffer[id]) * inverseMassBuffer[id];
+    velocityBuffer[id] = (velocityBuffer[id] + dt * acceleration) * damping;
+}
 
-__kernel void calcVolumes(
+// One of the first three RK4 stages. forceBuffer holds the force at the
+// current stage position; the derivative of the stage (its velocity and
+// acceleration) is added to the weighted sums, and the next stage state is
+// the start state advanced by h along it. The first stage uses the start
+// velocity and starts the sums.
+__kernel void rk4Stage(float h, float weight, int first,
+        __global float *inverseMassBuffer,
+        __global float4 *positionBuffer,
+        __global float4 *velocityBuffer,
+        __global float4 *forceBuffer,
+        __global float4 *stagePositionBuffer,
+        __global float4 *stageVelocityBuffer,
+        __global float4 *sumPositionBuffer,
+        __global float4 *sumVelocityBuffer) {
+    int id = get_global_id(0);
+
+    float4 dx = first ? velocityBuffer[id] : stageVelocityBuffer[id];
+    float4 dv = forceBuffer[id] * inverseMassBuffer[id];
+
+    sumPositionBuffer[id] = (first ? (float4)(0) : sumPositionBuffer[id]) + weight * dx;
+    sumVelocityBuffer[id] = (first ? (float4)(0) : sumVelocityBuffer[id]) + weight * dv;
+
+    stagePositionBuffer[id] = positionBuffer[id] + h * dx;
+    stageVelocityBuffer[id] = velocityBuffer[id] + h * dv;
+}
+
+// last RK4 stage: combines the four derivatives into the new state
+__kernel void rk4Finish(float dt, float damping,
+        __global float *inverseMassBuffer,
+        __global float4 *forceBuffer,
+        __global float4 *stageVelocityBuffer,
+        __global float4 *sumPositionBuffer,
+        __global float4 *sumVelocityBuffer,
+        __global float4 *velocityBuffer,
+        __global float4 *positionBuffer) {
+    int id = get_global_id(0);
+
+    float4 dx = sumPositionBuffer[id] + stageVelocityBuffer[id];
+    float4 dv = sumVelocityBuffer[id] + forceBuffer[id] * inverseMassBuffer[id];
+
+    float4 position = positionBuffer[id] + dt / 6.0f * dx;
+    float4 velocity = velocityBuffer[id] + dt / 6.0f * dv;
+
+    collidePlane(&position, &velocity);
+
+    velocityBuffer[id] = velocity * damping;
+    positionBuffer[id] = position;
+}
+
+
+// signed volume of the tetrahedron spanned by a face and the origin
+float faceVolume(__global float4 *positionBuffer, int4 face) {
+    return dot(positionBuffer[face.x], cross(positionBuffer[face.y], positionBuffer[face.z])) / 6.0f;
+}
+
+// signed volume of the tetrahedra spanned by the faces and the origin,
+// summed per work-group into partialBuffer
+__kernel __attribute__((reqd_work_group_size(REDUCE_GROUP_SIZE, 1, 1)))
+void calcVolumes(int faceCount,
         __global float4 *positionBuffer,
         __global int4 *faceBuffer,
-        __global float *volumeBuffer) {
+        __global float *partialBuffer) {
+    __local float scratch[REDUCE_GROUP_SIZE];
+
     int face = get_global_id(0);
+    int lid = get_local_id(0);
+
+    float volume = 0;
+    if (face < faceCount) {
+        volume = faceVolume(positionBuffer, faceBuffer[face]);
+    }
+    scratch[lid] = volume;
+
+    reduceLocal(scratch);
+
+    if (lid == 0) {
+        partialBuffer[get_group_id(0)] = scratch[0];
+    }
+}
 
-    volumeBuffer[face] = dot(
-            positionBuffer[faceBuffer[face].x],
-            cross(
-                    positionBuffer[faceBuffer[face].y],
-                    positionBuffer[faceBuffer[face].z])) / 6.0f;
+// run as a single work-group: adds up the partial sums of calcVolumes
+__kernel __attribute__((reqd_work_group_size(REDUCE_GROUP_SIZE, 1, 1)))
+void sumVolumes(int partialCount,
+        __global float *partialBuffer,
+        __global float *volumeBuffer) {
+    __local float scratch[REDUCE_GROUP_SIZE];
+
+    int lid = get_local_id(0);
+
+    float sum = 0;
+    for (int i = lid; i < partialCount; i += REDUCE_GROUP_SIZE) {
+        sum += partialBuffer[i];
+    }
+    scratch[lid] = sum;
+
+    reduceLocal(scratch);
+
+    if (lid == 0) {
+        volumeBuffer[0] = scratch[0];
+    }
 }
 
 
-__kernel void applyPressure(float pressureDiff, int maxCornered,
+// faces around a point are otherCornerBuffer[cornerOffsetBuffer[point] .. cornerOffsetBuffer[point + 1])
+float4 pressureForce(int point, float4 position, float pressureDiff,
+        __global float4 *positionBuffer,
+        __global int *cornerOffsetBuffer,
+        __global int2 *otherCornerBuffer) {
+    float4 force = (float4)(0);
+
+    for (int i = cornerOffsetBuffer[point]; i < cornerOffsetBuffer[point + 1]; ++i) {
+        int2 others = otherCornerBuffer[i];
+
+        float4 b = positionBuffer[others.x];
+        float4 c = positionBuffer[others.y];
+
+        force += cross(b - position, c - position) * pressureDiff * 20000;
+    }
+
+    return force;
+}
+
+__kernel void applyPressure(float initVolume,
+        __global float *volumeBuffer,
         __global float4 *positionBuffer,
-        __global int *corneredBuffer,
+        __global int *cornerOffsetBuffer,
         __global int2 *otherCornerBuffer,
         __global float4 *forceBuffer
 ) {
     int point = get_global_id(0);
 
-    for (int i = 0; i < corneredBuffer[point]; ++i) {
-        int other1 = otherCornerBuffer[maxCornered * point + i].x;
-        int other2 = otherCornerBuffer[maxCornered * point + i].y;
-
-        float4 a = positionBuffer[point];
-        float4 b = positionBuffer[other1];
-        float4 c = positionBuffer[other2];
+    float pressureDiff = initVolume - volumeBuffer[0];
 
-        float4 cp = cross(b-a, c-a);
-        forceBuffer[point] += cp * pressureDiff * 20000;
-    }
+    forceBuffer[point] += pressureForce(point, positionBuffer[point], pressureDiff,
+                                        positionBuffer, cornerOffsetBuffer, otherCornerBuffer);
 }
 
-__kernel void calcNormals(int maxCornered,
-                            __global float4 *positionBuffer,
-__global int *corneredBuffer,
+__kernel void calcNormals(
+        __global float4 *positionBuffer,
+        __global int *cornerOffsetBuffer,
         __global int2 *otherCornerBuffer,
         __global float4 *normalBuffer
 ) {
@@ -103,9 +359,9 @@ __global int *corneredBuffer,
 
     float4 normal = (float4)(0);
 
-    for (int i = 0; i < corneredBuffer[point]; ++i) {
-        int other1 = otherCornerBuffer[maxCornered * point + i].x;
-        int other2 = otherCornerBuffer[maxCornered * point + i].y;
+    for (int i = cornerOffsetBuffer[point]; i < cornerOffsetBuffer[point + 1]; ++i) {
+        int other1 = otherCornerBuffer[i].x;
+        int other2 = otherCornerBuffer[i].y;
 
         float4 a = positionBuffer[point];
         float4 b = positionBuffer[other1];
@@ -116,4 +372,836 @@ __global int *corneredBuffer,
     }
 
     normalBuffer[point] = normalize(normal);
-}
\ No newline at end of file
+}
+
+
+// calcForces, applyPressure, integrate1Euler and integrate2Euler in a single
+// launch, keeping the force of the vertex in registers. Positions are read from
+// positionIn and written to positionOut, so every vertex sees its neighbours
+// as they were at the start of the substep, just like the separate kernels do.
+void stepFusedPoint(int point, float dt, float pressureDiff,
+        __global float4 *positionIn,
+        __global float *inverseMassBuffer,
+        __global int *pairOffsetBuffer,
+        __global int *pairBuffer,
+        __global float2 *pairParamBuffer,
+        __global int *cornerOffsetBuffer,
+        __global int2 *otherCornerBuffer,
+        __global float4 *velocityBuffer,
+        __global float4 *positionOut)
+{
+    float4 position = positionIn[point];
+    float invMass = inverseMassBuffer[point];
+
+    float4 force = (float4)(0);
+    if (invMass > 1e-5f) {
+        force = gravity / invMass;
+    }
+
+    for (int i = pairOffsetBuffer[point]; i < pairOffsetBuffer[point + 1]; ++i) {
+        float4 other = positionIn[pairBuffer[i]];
+        float2 params = pairParamBuffer[i];
+
+        float dist = distance(other, position);
+
+        if (dist < 1e-5f) continue;
+
+        force += (other - position) / dist * params.y * (dist - params.x);
+    }
+
+    force += pressureForce(point, position, pressureDiff, positionIn, cornerOffsetBuffer, otherCornerBuffer);
+
+    float4 velocity = velocityBuffer[point] + dt * force * invMass;
+
+    position += dt * velocity;
+
+    collidePlane(&position, &velocity);
+    velocity *= 0.999f;
+
+    velocityBuffer[point] = velocity;
+    positionOut[point] = position;
+}
+
+__kernel void stepFused(float dt, float initVolume,
+        __global float *volumeBuffer,
+        __global float4 *positionIn,
+        __global float *inverseMassBuffer,
+        __global int *pairOffsetBuffer,
+        __global int *pairBuffer,
+        __global float2 *pairParamBuffer,
+        __global int *cornerOffsetBuffer,
+        __global int2 *otherCornerBuffer,
+        __global float4 *velocityBuffer,
+        __global float4 *positionOut)
+{
+    stepFusedPoint(get_global_id(0), dt, initVolume - volumeBuffer[0],
+                   positionIn, inverseMassBuffer, pairOffsetBuffer, pairBuffer, pairParamBuffer,
+                   cornerOffsetBuffer, otherCornerBuffer, velocityBuffer, positionOut);
+}
+
+
+// Batched variants for VolumeWorld: the buffers hold every object of the
+// world back to back, with all indices global. calcForces, calcNormals and
+// the integrators need no object information and are shared; the kernels
+// below look up the object of the point in objectBuffer and read its target
+// volume from initVolumeBuffer and its current one from volumeBuffer.
+
+// like calcVolumes, one partial sum per work-group, but the groups of an
+// object are partialOffsetBuffer[object] .. partialOffsetBuffer[object + 1]
+// and each covers REDUCE_GROUP_SIZE of the faces
+// [faceOffsetBuffer[object] .. faceOffsetBuffer[object + 1]); groupObjectBuffer
+// holds the object of every group
+__kernel __attribute__((reqd_work_group_size(REDUCE_GROUP_SIZE, 1, 1)))
+void calcVolumesWorld(
+        __global int *faceOffsetBuffer,
+        __global int *partialOffsetBuffer,
+        __global int *groupObjectBuffer,
+        __global float4 *positionBuffer,
+        __global int4 *faceBuffer,
+        __global float *partialBuffer) {
+    __local float scratch[REDUCE_GROUP_SIZE];
+
+    int group = get_group_id(0);
+    int lid = get_local_id(0);
+    int object = groupObjectBuffer[group];
+
+    int face = faceOffsetBuffer[object] + (group - partialOffsetBuffer[object]) * REDUCE_GROUP_SIZE + lid;
+
+    float volume = 0;
+    if (face < faceOffsetBuffer[object + 1]) {
+        volume = faceVolume(positionBuffer, faceBuffer[face]);
+    }
+    scratch[lid] = volume;
+
+    reduceLocal(scratch);
+
+    if (lid == 0) {
+        partialBuffer[group] = scratch[0];
+    }
+}
+
+// one work-group per object: adds up its partial sums of calcVolumesWorld
+__kernel __attribute__((reqd_work_group_size(REDUCE_GROUP_SIZE, 1, 1)))
+void sumVolumesWorld(
+        __global int *partialOffsetBuffer,
+        __global float *partialBuffer,
+        __global float *volumeBuffer) {
+    __local float scratch[REDUCE_GROUP_SIZE];
+
+    int object = get_group_id(0);
+    int lid = get_local_id(0);
+
+    float sum = 0;
+    for (int i = partialOffsetBuffer[object] + lid; i < partialOffsetBuffer[object + 1]; i += REDUCE_GROUP_SIZE) {
+        sum += partialBuffer[i];
+    }
+    scratch[lid] = sum;
+
+    reduceLocal(scratch);
+
+    if (lid == 0) {
+        volumeBuffer[object] = scratch[0];
+    }
+}
+
+__kernel void applyPressureWorld(
+        __global float *initVolumeBuffer,
+        __global float *volumeBuffer,
+        __global int *objectBuffer,
+        __global float4 *positionBuffer,
+        __global int *cornerOffsetBuffer,
+        __global int2 *otherCornerBuffer,
+        __global float4 *forceBuffer
+) {
+    int point = get_global_id(0);
+    int object = objectBuffer[point];
+
+    float pressureDiff = initVolumeBuffer[object] - volumeBuffer[object];
+
+    forceBuffer[point] += pressureForce(point, positionBuffer[point], pressureDiff,
+                                        positionBuffer, cornerOffsetBuffer, otherCornerBuffer);
+}
+
+__kernel void stepFusedWorld(float dt,
+        __global float *initVolumeBuffer,
+        __global float *volumeBuffer,
+        __global int *objectBuffer,
+        __global float4 *positionIn,
+        __global float *inverseMassBuffer,
+        __global int *pairOffsetBuffer,
+        __global int *pairBuffer,
+        __global float2 *pairParamBuffer,
+        __global int *cornerOffsetBuffer,
+        __global int2 *otherCornerBuffer,
+        __global float4 *velocityBuffer,
+        __global float4 *positionOut)
+{
+    int point = get_global_id(0);
+    int object = objectBuffer[point];
+
+    stepFusedPoint(point, dt, initVolumeBuffer[object] - volumeBuffer[object],
+                   positionIn, inverseMassBuffer, pairOffsetBuffer, pairBuffer, pairParamBuffer,
+                   cornerOffsetBuffer, otherCornerBuffer, velocityBuffer, positionOut);
+}
+
+
+// Backward Euler for the springs (ImplicitSolver). Per substep it solves
+//     (M - dt^2 K) dv = dt (f + dt K v)
+// for the velocity change dv with a Jacobi preconditioned conjugate gradient,
+// where f is the force at the start of the step (springs, pressure and
+// gravity) and K the spring part of its Jacobian. Pressure stays explicit.
+// Points with zero inverse mass are pinned: their rows are the identity.
+//
+// K is stored per CSR pair as the symmetric 3x3 block d f_i / d x_j in a
+// float8 (xx, xy, xz, yy, yz, zz, -, -); the diagonal block of row i is minus
+// the sum of the blocks of the row, so (K p)_i = sum_j K_ij (p_j - p_i).
+
+// slots of the scalar buffer of the solver
+#define CG_RZ 0         // r.z of the current iteration, ping-pongs between slots 0 and 1
+#define CG_PQ 2         // p.Ap
+#define CG_RZ0 3        // r.z of the start, for the convergence test
+
+float4 blockMul(float8 k, float4 p) {
+    return (float4)(k.s0 * p.x + k.s1 * p.y + k.s2 * p.z,
+                    k.s1 * p.x + k.s3 * p.y + k.s4 * p.z,
+                    k.s2 * p.x + k.s4 * p.y + k.s5 * p.z,
+                    0);
+}
+
+// Jacobian of every spring at the current positions, and the inverse of the
+// diagonal of M - dt^2 K. The compression term is clamped to zero so the
+// matrix stays positive definite.
+__kernel void assembleJacobian(int count, float dt2,
+        __global float *inverseMassBuffer,
+        __global float4 *positionBuffer,
+        __global int *pairOffsetBuffer,
+        __global int *pairBuffer,
+        __global float2 *pairParamBuffer,
+        __global float8 *jacobianBuffer,
+        __global float4 *inverseDiagonalBuffer) {
+    int point = get_global_id(0);
+    if (point >= count) {
+        return;
+    }
+
+    float4 position = positionBuffer[point];
+    float4 diagonal = (float4)(0);
+
+    for (int i = pairOffsetBuffer[point]; i < pairOffsetBuffer[point + 1]; ++i) {
+        float4 d = positionBuffer[pairBuffer[i]] - position;
+        d.w = 0;
+        float len = length(d);
+
+        float8 k = (float8)(0);
+        if (len > 1e-5f) {
+            float4 u = d / len;
+            float stiffness = pairParamBuffer[i].y;
+            float c = max(0.0f, 1.0f - pairParamBuffer[i].x / len);
+
+            // k (u u^T + c (I - u u^T))
+            float s = stiffness * (1.0f - c);
+            float iso = stiffness * c;
+            k = (float8)(s * u.x * u.x + iso, s * u.x * u.y, s * u.x * u.z,
+                         s * u.y * u.y + iso, s * u.y * u.z,
+                         s * u.z * u.z + iso, 0, 0);
+        }
+        jacobianBuffer[i] = k;
+        diagonal += (float4)(k.s0, k.s3, k.s5, 0);
+    }
+
+    float invMass = inverseMassBuffer[point];
+    if (invMass > 1e-5f) {
+        inverseDiagonalBuffer[point] = 1.0f / (1.0f / invMass + dt2 * diagonal);
+        inverseDiagonalBuffer[point].w = 0;
+    } else {
+        inverseDiagonalBuffer[point] = (float4)(1, 1, 1, 0);
+    }
+}
+
+// (K v)_i
+float4 jacobianMul(int point,
+        __global int *pairOffsetBuffer,
+        __global int *pairBuffer,
+        __global float8 *jacobianBuffer,
+        __global float4 *vectorBuffer) {
+    float4 own = vectorBuffer[point];
+    float4 sum = (float4)(0);
+    for (int i = pairOffsetBuffer[point]; i < pairOffsetBuffer[point + 1]; ++i) {
+        sum += blockMul(jacobianBuffer[i], vectorBuffer[pairBuffer[i]] - own);
+    }
+    return sum;
+}
+
+// right hand side and the start of the iteration: dv = 0, r = b, z = p = P r,
+// with the per work-group parts of r.z in partialBuffer
+__kernel __attribute__((reqd_work_group_size(REDUCE_GROUP_SIZE, 1, 1)))
+void implicitRhs(int count, float dt,
+        __global float *inverseMassBuffer,
+        __global float4 *forceBuffer,
+        __global float4 *velocityBuffer,
+        __global int *pairOffsetBuffer,
+        __global int *pairBuffer,
+        __global float8 *jacobianBuffer,
+        __global float4 *inverseDiagonalBuffer,
+        __global float4 *deltaVelocityBuffer,
+        __global float4 *residualBuffer,
+        __global float4 *preconditionedBuffer,
+        __global float4 *directionBuffer,
+        __global float *partialBuffer) {
+    __local float scratch[REDUCE_GROUP_SIZE];
+
+    int point = get_global_id(0);
+    int lid = get_local_id(0);
+
+    float rz = 0;
+    if (point < count) {
+        float4 b = (float4)(0);
+        if (inverseMassBuffer[point] > 1e-5f) {
+            b = dt * (forceBuffer[point] +
+                      dt * jacobianMul(point, pairOffsetBuffer, pairBuffer, jacobianBuffer, velocityBuffer));
+            b.w = 0;
+        }
+        float4 z = inverseDiagonalBuffer[point] * b;
+
+        deltaVelocityBuffer[point] = (float4)(0);
+        residualBuffer[point] = b;
+        preconditionedBuffer[point] = z;
+        directionBuffer[point] = z;
+        rz = dot(b, z);
+    }
+    scratch[lid] = rz;
+
+    reduceLocal(scratch);
+
+    if (lid == 0) {
+        partialBuffer[get_group_id(0)] = scratch[0];
+    }
+}
+
+// q = (M - dt^2 K) p, with the parts of p.q in partialBuffer
+__kernel __attribute__((reqd_work_group_size(REDUCE_GROUP_SIZE, 1, 1)))
+void implicitMatVec(int count, float dt2,
+        __global float *inverseMassBuffer,
+        __global int *pairOffsetBuffer,
+        __global int *pairBuffer,
+        __global float8 *jacobianBuffer,
+        __global float4 *directionBuffer,
+        __global float4 *productBuffer,
+        __global float *partialBuffer) {
+    __local float scratch[REDUCE_GROUP_SIZE];
+
+    int point = get_global_id(0);
+    int lid = get_local_id(0);
+
+    float pq = 0;
+    if (point < count) {
+        float4 p = directionBuffer[point];
+        float invMass = inverseMassBuffer[point];
+
+        float4 q = p;
+        if (invMass > 1e-5f) {
+            q = p / invMass - dt2 * jacobianMul(point, pairOffsetBuffer, pairBuffer, jacobianBuffer, directionBuffer);
+        }
+        q.w = 0;
+
+        productBuffer[point] = q;
+        pq = dot(p, q);
+    }
+    scratch[lid] = pq;
+
+    reduceLocal(scratch);
+
+    if (lid == 0) {
+        partialBuffer[get_group_id(0)] = scratch[0];
+    }
+}
+
+// single work-group: scalarBuffer[slot] (and [copySlot] if not negative) = sum of the parts
+__kernel __attribute__((reqd_work_group_size(REDUCE_GROUP_SIZE, 1, 1)))
+void sumPartials(int partialCount,
+        __global float *partialBuffer,
+        __global float *scalarBuffer,
+        int slot, int copySlot) {
+    __local float scratch[REDUCE_GROUP_SIZE];
+
+    int lid = get_local_id(0);
+
+    float sum = 0;
+    for (int i = lid; i < partialCount; i += REDUCE_GROUP_SIZE) {
+        sum += partialBuffer[i];
+    }
+    scratch[lid] = sum;
+
+    reduceLocal(scratch);
+
+    if (lid == 0) {
+        scalarBuffer[slot] = scratch[0];
+        if (copySlot >= 0) {
+            scalarBuffer[copySlot] = scratch[0];
+        }
+    }
+}
+
+// dv += alpha p, r -= alpha q, z = P r, with the parts of the new r.z in
+// partialBuffer. Once r.z fell below tolerance2 times its start value
+// alpha is zero and the remaining iterations change nothing.
+__kernel __attribute__((reqd_work_group_size(REDUCE_GROUP_SIZE, 1, 1)))
+void pcgUpdate(int count, int rzSlot, float tolerance2,
+        __global float *scalarBuffer,
+        __global float4 *inverseDiagonalBuffer,
+        __global float4 *directionBuffer,
+        __global float4 *productBuffer,
+        __global float4 *deltaVelocityBuffer,
+        __global float4 *residualBuffer,
+        __global float4 *preconditionedBuffer,
+        __global float *partialBuffer) {
+    __local float scratch[REDUCE_GROUP_SIZE];
+
+    int point = get_global_id(0);
+    int lid = get_local_id(0);
+
+    float rz = scalarBuffer[rzSlot];
+    float pq = scalarBuffer[CG_PQ];
+    float alpha = (rz > tolerance2 * scalarBuffer[CG_RZ0] && pq > 0) ? rz / pq : 0;
+
+    float rzNew = 0;
+    if (point < count) {
+        deltaVelocityBuffer[point] += alpha * directionBuffer[point];
+
+        float4 r = residualBuffer[point] - alpha * productBuffer[point];
+        float4 z = inverseDiagonalBuffer[point] * r;
+
+        residualBuffer[point] = r;
+        preconditionedBuffer[point] = z;
+        rzNew = dot(r, z);
+    }
+    scratch[lid] = rzNew;
+
+    reduceLocal(scratch);
+
+    if (lid == 0) {
+        partialBuffer[get_group_id(0)] = scratch[0];
+    }
+}
+
+// p = z + beta p
+__kernel void pcgDirection(int count, int rzSlot, int rzNewSlot,
+        __global float *scalarBuffer,
+        __global float4 *preconditionedBuffer,
+        __global float4 *directionBuffer) {
+    int point = get_global_id(0);
+    if (point >= count) {
+        return;
+    }
+
+    float rz = scalarBuffer[rzSlot];
+    float beta = rz > 0 ? scalarBuffer[rzNewSlot] / rz : 0;
+
+    directionBuffer[point] = preconditionedBuffer[point] + beta * directionBuffer[point];
+}
+
+__kernel void implicitIntegrate(float dt, float damping,
+        __global float4 *deltaVelocityBuffer,
+        __global float4 *velocityBuffer,
+        __global float4 *positionBuffer) {
+    int id = get_global_id(0);
+
+    float4 velocity = (velocityBuffer[id] + deltaVelocityBuffer[id]) * damping;
+    float4 position = positionBuffer[id] + dt * velocity;
+
+    collidePlane(&position, &velocity);
+
+    velocityBuffer[id] = velocity;
+    positionBuffer[id] = position;
+}
+
+
+// Extended position-based dynamics (XPBD). Every substep predicts positions
+// from the velocities and gravity, projects the constraints onto them a few
+// times and derives the new velocities from the displacement. The Lagrange
+// multipliers accumulate over the iterations of one substep, which makes the
+// compliance (inverse stiffness) independent of the iteration count and dt.
+//
+// Distance constraints are projected one color at a time; no two constraints
+// of a color share a point, so the writes do not race. The volume is a single
+// global constraint: its value and gradient norm are reduced like in the
+// implicit solver, then every point moves along its gradient.
+
+#define XPBD_VOLUME_LAMBDA 0     // multiplier of the volume constraint
+#define XPBD_VOLUME_DELTA 1      // its change in the current iteration
+
+__kernel void xpbdPredict(float dt,
+        __global float *inverseMassBuffer,
+        __global float4 *positionBuffer,
+        __global float4 *velocityBuffer,
+        __global float4 *predictedBuffer) {
+    int id = get_global_id(0);
+
+    float4 velocity = velocityBuffer[id];
+    if (inverseMassBuffer[id] > 1e-5f) {
+        velocity += dt * gravity;
+    }
+
+    predictedBuffer[id] = positionBuffer[id] + dt * velocity;
+}
+
+// constraints first .. first + global size, all of one color; the multipliers
+// start from zero in the first iteration of a substep
+__kernel void xpbdDistance(int first, int firstIteration, float dt2,
+        __global float *inverseMassBuffer,
+        __global int2 *constraintBuffer,
+        __global float2 *constraintParamBuffer,
+        __global float *lambdaBuffer,
+        __global float4 *predictedBuffer) {
+    int k = first + get_global_id(0);
+
+    int2 ends = constraintBuffer[k];
+    float2 params = constraintParamBuffer[k];
+
+    float wa = inverseMassBuffer[ends.x];
+    float wb = inverseMassBuffer[ends.y];
+    float4 a = predictedBuffer[ends.x];
+    float4 b = predictedBuffer[ends.y];
+
+    float lambda = firstIteration ? 0 : lambdaBuffer[k];
+    float alpha = params.y / dt2;
+    float w = wa + wb + alpha;
+
+    float4 d = b - a;
+    float len = length(d);
+
+    if (len > 1e-5f && w > 0) {
+        float4 n = d / len;
+        float deltaLambda = (params.x - len - alpha * lambda) / w;
+        lambda += deltaLambda;
+
+        predictedBuffer[ends.x] = a - wa * deltaLambda * n;
+        predictedBuffer[ends.y] = b + wb * deltaLambda * n;
+    }
+
+    lambdaBuffer[k] = lambda;
+}
+
+// gradient of the enclosed volume with respect to every point, with the parts
+// of sum(w |gradient|^2) in partialBuffer
+__kernel __attribute__((reqd_work_group_size(REDUCE_GROUP_SIZE, 1, 1)))
+void xpbdVolumeGradient(int count,
+        __global float *inverseMassBuffer,
+        __global float4 *predictedBuffer,
+        __global int *cornerOffsetBuffer,
+        __global int2 *otherCornerBuffer,
+        __global float4 *gradientBuffer,
+        __global float *partialBuffer) {
+    __local float scratch[REDUCE_GROUP_SIZE];
+
+    int point = get_global_id(0);
+    int lid = get_local_id(0);
+
+    float weighted = 0;
+    if (point < count) {
+        float4 position = predictedBuffer[point];
+        float4 gradient = (float4)(0);
+
+        for (int i = cornerOffsetBuffer[point]; i < cornerOffsetBuffer[point + 1]; ++i) {
+            int2 others = otherCornerBuffer[i];
+            gradient += cross(predictedBuffer[others.x] - position, predictedBuffer[others.y] - position);
+        }
+        gradient /= 6.0f;
+
+        gradientBuffer[point] = gradient;
+        weighted = inverseMassBuffer[point] * dot(gradient, gradient);
+    }
+    scratch[lid] = weighted;
+
+    reduceLocal(scratch);
+
+    if (lid == 0) {
+        partialBuffer[get_group_id(0)] = scratch[0];
+    }
+}
+
+// single work-group: sums the volume (from calcVolumes) and the gradient norm,
+// then updates the multiplier of the volume constraint
+__kernel __attribute__((reqd_work_group_size(REDUCE_GROUP_SIZE, 1, 1)))
+void xpbdVolumeLambda(int volumePartialCount,
+        __global float *volumePartialBuffer,
+        int gradientPartialCount,
+        __global float *gradientPartialBuffer,
+        float targetVolume, float alpha, int firstIteration,
+        __global float *scalarBuffer) {
+    __local float scratch[REDUCE_GROUP_SIZE];
+
+    int lid = get_local_id(0);
+
+    float sum = 0;
+    for (int i = lid; i < volumePartialCount; i += REDUCE_GROUP_SIZE) {
+        sum += volumePartialBuffer[i];
+    }
+    scratch[lid] = sum;
+
+    reduceLocal(scratch);
+    float volume = scratch[0];
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    sum = 0;
+    for (int i = lid; i < gradientPartialCount; i += REDUCE_GROUP_SIZE) {
+        sum += gradientPartialBuffer[i];
+    }
+    scratch[lid] = sum;
+
+    reduceLocal(scratch);
+
+    if (lid == 0) {
+        float lambda = firstIteration ? 0 : scalarBuffer[XPBD_VOLUME_LAMBDA];
+        float w = scratch[0] + alpha;
+        float deltaLambda = w > 0 ? (targetVolume - volume - alpha * lambda) / w : 0;
+
+        scalarBuffer[XPBD_VOLUME_LAMBDA] = lambda + deltaLambda;
+        scalarBuffer[XPBD_VOLUME_DELTA] = deltaLambda;
+    }
+}
+
+__kernel void xpbdVolumeApply(
+        __global float *scalarBuffer,
+        __global float *inverseMassBuffer,
+        __global float4 *gradientBuffer,
+        __global float4 *predictedBuffer) {
+    int point = get_global_id(0);
+
+    predictedBuffer[point] += inverseMassBuffer[point] * scalarBuffer[XPBD_VOLUME_DELTA] * gradientBuffer[point];
+}
+
+__kernel void xpbdFinish(float dt, float damping,
+        __global float4 *predictedBuffer,
+        __global float4 *velocityBuffer,
+        __global float4 *positionBuffer) {
+    int id = get_global_id(0);
+
+    float4 position = predictedBuffer[id];
+    float4 velocity = (position - positionBuffer[id]) / dt * damping;
+
+    collidePlane(&position, &velocity);
+
+    velocityBuffer[id] = velocity;
+    positionBuffer[id] = position;
+}
+
+
+// Collisions between the points and faces of a VolumeWorld (CollisionGrid).
+// Every substep the faces are hashed by their centroid into a uniform grid of
+// cellSize and counting sorted by cell: countFaces counts the faces of each
+// hash table entry, scanCounts/scanGroupSums/addGroupSums turn the counts into
+// the first sorted index of every entry, and scatterFaces writes the faces in
+// that order. collidePoints then only tests the faces in the 27 cells around
+// each point. cellSize is at least the reach of a face from its centroid plus
+// the contact thickness, so no face in contact is missed.
+
+uint cellHash(int4 cell, uint tableMask) {
+    return (((uint) cell.x * 73856093u) ^ ((uint) cell.y * 19349663u) ^ ((uint) cell.z * 83492791u)) & tableMask;
+}
+
+int4 cellOf(float4 position, float cellSize) {
+    return convert_int4_rtn(position / cellSize);
+}
+
+__kernel void clearCells(__global int *cellCountBuffer) {
+    cellCountBuffer[get_global_id(0)] = 0;
+}
+
+// the cell of every face, and its rank among the faces of that cell
+__kernel void countFaces(float cellSize, uint tableMask,
+        __global float4 *positionBuffer,
+        __global int4 *faceBuffer,
+        __global uint *faceCellBuffer,
+        __global int *faceRankBuffer,
+        __global int *cellCountBuffer) {
+    int face = get_global_id(0);
+
+    int4 corners = faceBuffer[face];
+    float4 centroid = (positionBuffer[corners.x] + positionBuffer[corners.y] + positionBuffer[corners.z]) / 3.0f;
+
+    uint cell = cellHash(cellOf(centroid, cellSize), tableMask);
+    faceCellBuffer[face] = cell;
+    faceRankBuffer[face] = atomic_inc(&cellCountBuffer[cell]);
+}
+
+// inclusive prefix sum of scratch[] over the work-group
+void scanLocal(__local int *scratch) {
+    int lid = get_local_id(0);
+    for (int offset = 1; offset < REDUCE_GROUP_SIZE; offset *= 2) {
+        barrier(CLK_LOCAL_MEM_FENCE);
+        int add = lid >= offset ? scratch[lid - offset] : 0;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        scratch[lid] += add;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+}
+
+// exclusive prefix sum of the counts within each work-group, with the total of
+// the group in groupSumBuffer
+__kernel __attribute__((reqd_work_group_size(REDUCE_GROUP_SIZE, 1, 1)))
+void scanCounts(
+        __global int *cellCountBuffer,
+        __global int *cellStartBuffer,
+        __global int *groupSumBuffer) {
+    __local int scratch[REDUCE_GROUP_SIZE];
+
+    int id = get_global_id(0);
+    int lid = get_local_id(0);
+
+    int count = cellCountBuffer[id];
+    scratch[lid] = count;
+
+    scanLocal(scratch);
+
+    cellStartBuffer[id] = scratch[lid] - count;
+    if (lid == REDUCE_GROUP_SIZE - 1) {
+        groupSumBuffer[get_group_id(0)] = scratch[lid];
+    }
+}
+
+// run as a single work-group: exclusive prefix sum of the group totals in place
+__kernel __attribute__((reqd_work_group_size(REDUCE_GROUP_SIZE, 1, 1)))
+void scanGroupSums(int groupCount,
+        __global int *groupSumBuffer) {
+    __local int scratch[REDUCE_GROUP_SIZE];
+
+    int lid = get_local_id(0);
+
+    int carry = 0;
+    for (int base = 0; base < groupCount; base += REDUCE_GROUP_SIZE) {
+        int i = base + lid;
+        int sum = i < groupCount ? groupSumBuffer[i] : 0;
+        scratch[lid] = sum;
+
+        scanLocal(scratch);
+
+        if (i < groupCount) {
+            groupSumBuffer[i] = carry + scratch[lid] - sum;
+        }
+        carry += scratch[REDUCE_GROUP_SIZE - 1];
+    }
+}
+
+__kernel __attribute__((reqd_work_group_size(REDUCE_GROUP_SIZE, 1, 1)))
+void addGroupSums(
+        __global int *groupSumBuffer,
+        __global int *cellStartBuffer) {
+    cellStartBuffer[get_global_id(0)] += groupSumBuffer[get_group_id(0)];
+}
+
+__kernel void scatterFaces(
+        __global int4 *faceBuffer,
+        __global uint *faceCellBuffer,
+        __global int *faceRankBuffer,
+        __global int *cellStartBuffer,
+        __global int4 *sortedFaceBuffer) {
+    int face = get_global_id(0);
+
+    sortedFaceBuffer[cellStartBuffer[faceCellBuffer[face]] + faceRankBuffer[face]] = faceBuffer[face];
+}
+
+// whether a corner of the face is the point or one of its spring neighbours
+bool nearFace(int point, int4 corners,
+        __global int *pairOffsetBuffer,
+        __global int *pairBuffer) {
+    if (corners.x == point || corners.y == point || corners.z == point) {
+        return true;
+    }
+
+    for (int i = pairOffsetBuffer[point]; i < pairOffsetBuffer[point + 1]; ++i) {
+        int other = pairBuffer[i];
+        if (corners.x == other || corners.y == other || corners.z == other) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Pushes every point out of the faces it is closer than thickness to, along
+// the face normal, and removes its velocity towards the face. A face of
+// another object is left to the outside (the faces wind outwards); a face of
+// the point's own object to the side the point is on, skipping the faces
+// around the point and its neighbours. Of several contacts the deepest wins.
+__kernel void collidePoints(float cellSize, uint tableMask, float thickness,
+        __global float4 *positionIn,
+        __global float4 *velocityBuffer,
+        __global int *objectBuffer,
+        __global int *pairOffsetBuffer,
+        __global int *pairBuffer,
+        __global int *cellStartBuffer,
+        __global int *cellCountBuffer,
+        __global int4 *sortedFaceBuffer,
+        __global float4 *positionOut) {
+    int point = get_global_id(0);
+
+    float4 position = positionIn[point];
+    int object = objectBuffer[point];
+    int4 cell = cellOf(position, cellSize);
+
+    float depth = 0;
+    float4 normal = (float4)(0);
+
+    for (int z = -1; z <= 1; ++z) {
+        for (int y = -1; y <= 1; ++y) {
+            for (int x = -1; x <= 1; ++x) {
+                uint hash = cellHash(cell + (int4)(x, y, z, 0), tableMask);
+                int end = cellStartBuffer[hash] + cellCountBuffer[hash];
+
+                for (int k = cellStartBuffer[hash]; k < end; ++k) {
+                    int4 corners = sortedFaceBuffer[k];
+
+                    float4 a = positionIn[corners.x];
+                    float4 b = positionIn[corners.y];
+                    float4 c = positionIn[corners.z];
+
+                    float4 n = cross(b - a, c - a);
+                    float len = length(n);
+                    if (len < 1e-12f) {
+                        continue;
+                    }
+                    n /= len;
+
+                    float distance = dot(position - a, n);
+                    if (distance >= thickness || distance <= -thickness) {
+                        continue;
+                    }
+
+                    // the projection onto the plane has to be inside the face
+                    float4 q = position - distance * n;
+                    if (dot(cross(b - a, q - a), n) < 0 ||
+                        dot(cross(c - b, q - b), n) < 0 ||
+                        dot(cross(a - c, q - c), n) < 0) {
+                        continue;
+                    }
+
+                    float side = 1;
+                    if (objectBuffer[corners.x] == object) {
+                        if (nearFace(point, corners, pairOffsetBuffer, pairBuffer)) {
+                            continue;
+                        }
+                        side = distance < 0 ? -1 : 1;
+                    }
+
+                    float push = thickness - side * distance;
+                    if (push > depth) {
+                        depth = push;
+                        normal = side * n;
+                    }
+                }
+            }
+        }
+    }
+
+    if (depth > 0) {
+        position += depth * normal;
+
+        float4 velocity = velocityBuffer[point];
+        float approach = dot(velocity, normal);
+        if (approach < 0) {
+            velocityBuffer[point] = velocity - approach * normal;
+        }
+    }
+
+    positionOut[point] = position;
+}
@@ -1,5 +1,8 @@
 #include <SDL2/SDL.h>
 
+#include <cstring>
+#include <memory>
+
 #include <GL/glu.h>
 
 #include "clwrapper.hpp"
@@ -7,15 +10,22 @@
 #include "SpringyObject.hpp"
 #include "Camera.hpp"
 #include "VolumeMesh.hpp"
+#include "VolumeWorld.hpp"
+#include "NativeVolumeMesh.hpp"
+#include "ThreadPool.hpp"
+#include "MeshLoader.hpp"
+#include "Renderer.hpp"
+#include "Integrator.hpp"
+#include "SpringForces.hpp"
 #include "Sphere.hpp"
+#include "Profiler.hpp"
 
 const int width = 1600;
 const int height = 900;
 
-CLWrapper cl;
-
 #define TIME( call ) \
     { \
+        ProfileScope scope(#call); \
         int ticks1 = SDL_GetTicks();\
         call; \
         int ticks2 = SDL_GetTicks();\
@@ -26,11 +36,34 @@ CLWrapper cl;
 std::vector<AbstractObject *> objects;
 std::vector<Sphere *> spheres;
 
+bool fused = false;
+Integrator integrator = Integrator::Euler;
+int substeps = 10;
+
+// with --batched every volume object is packed into this single world,
+// which is then also the only entry of objects
+bool batched = false;
+VolumeWorld *world = 0;
+
+// with --collisions the world also keeps its objects out of each other (implies --batched)
+bool collisions = false;
+
+// with --backend native volume objects are NativeVolumeMeshes, stepped on the host
+bool native = false;
+
+// volume meshes are loaded in the background and added at the start of a frame
+MeshLoader *loader = 0;
+
 void clear() {
     for (auto &o : objects) {
         delete o;
     }
     objects.clear();
+    world = 0;
+
+    if (loader) {
+        loader->discardPending();
+    }
 
     for (auto &s : spheres) {
         delete s;
@@ -39,23 +72,77 @@ void clear() {
 }
 
 void spawnVolume(std::string name) {
-    auto t = new VolumeMesh(name);
+    std::cout << "Loading " << name << std::endl;
+    loader->load(name);
+}
+
+// creates the object of a loaded mesh; only the device buffers are set up here
+void addVolume(std::unique_ptr<MeshData> mesh) {
+    if (native) {
+        auto t = new NativeVolumeMesh(std::move(*mesh));
+        t->setIntegrator(integrator);
+        objects.push_back(t);
+        return;
+    }
+
+    if (batched) {
+        if (!world) {
+            world = new VolumeWorld();
+            world->setFused(fused);
+            world->setIntegrator(integrator);
+            world->setCollisions(collisions);
+            objects.push_back(world);
+        }
+        world->add(std::move(mesh));
+        return;
+    }
+
+    auto t = new VolumeMesh(std::move(*mesh));
+    t->setFused(fused);
+    t->setIntegrator(integrator);
     objects.push_back(t);
 }
 
-void stepAll(float dt, int substeps = 10) {
+void removeLast() {
+    if (world) {
+        world->removeLast();
+    } else if (!objects.empty()) {
+        delete objects.back();
+        objects.pop_back();
+    }
+}
+
+// enqueues the whole frame for every object and waits only once at the end,
+// so the host can keep enqueueing while the device works; with a readback
+// latency it does not wait at all, the device runs while the host draws
+void stepAll(float dt) {
     for (const auto &o : objects) {
         for (int i = 0; i < substeps; ++i) {
             o->step(dt / substeps);
         }
-        clFinish(cl.cqueue());
+    }
+    if (!CLWrapper::instance) {
+        return;
+    }
+    if (CLWrapper::readbackLatency > 0) {
+        clFlush(CLWrapper::instance->cqueue());
+    } else {
+        clFinish(CLWrapper::instance->cqueue());
     }
 }
 
 void renderAll() {
+    for (const auto &o : objects) {
+        o->endFrame();
+    }
+    if (CLWrapper::instance) {
+        clFlush(CLWrapper::instance->cqueue());
+    }
+
     for (const auto &o : objects) {
         o->render();
     }
+    MeshRenderer::instance->flush();
 
     for (const auto &s : spheres) {
         s->render();
@@ -75,7 +162,65 @@ void deflateAll(float dt) {
     }
 }
 
-int main() {
+int main(int argc, char **argv) {
+    DeviceSelection selection = DeviceSelection::fromEnvironment();
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--list-devices")) {
+            CLWrapper::listDevices();
+            return EXIT_SUCCESS;
+        } else if (!strcmp(argv[i], "--batched")) {
+            batched = true;
+        } else if (!strcmp(argv[i], "--collisions")) {
+            collisions = true;
+            batched = true;
+        } else if (!strcmp(argv[i], "--out-of-order")) {
+            CLWrapper::outOfOrderQueue = true;
+        } else if (!strcmp(argv[i], "--integrator") && i + 1 < argc && parseIntegrator(argv[i + 1], integrator)) {
+            ++i;
+        } else if (!strcmp(argv[i], "--backend") && i + 1 < argc &&
+                   (!strcmp(argv[i + 1], "native") || !strcmp(argv[i + 1], "opencl"))) {
+            native = !strcmp(argv[++i], "native");
+        } else if (!strcmp(argv[i], "--threads") && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            ThreadPool::defaultThreads = (size_t) atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--forces") && i + 1 < argc && parseForceMethod(argv[i + 1], SpringForces::defaultMethod)) {
+            ++i;
+        } else if (!strcmp(argv[i], "--substeps") && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            substeps = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--readback-latency") && i + 1 < argc && atoi(argv[i + 1]) >= 0) {
+            CLWrapper::readbackLatency = atoi(argv[++i]);
+        } else if (!selection.parseArg(i, argc, argv)) {
+            std::cerr << "usage: " << argv[0] << " [options]\n"
+                    "  --batched          simulate all volume objects in one VolumeWorld\n"
+                    "  --collisions       keep the volume objects out of each other and themselves (implies --batched)\n"
+                    "  --out-of-order     let independent objects run concurrently (or GPGPU_HF_OUT_OF_ORDER)\n"
+                    "  --integrator I     euler, symplectic, verlet, rk4, implicit or xpbd (N cycles them at runtime)\n"
+                    "  --backend B        opencl (default) or native: volume objects on the host threads\n"
+                    "  --threads N        threads of the native backend (default: all)\n"
+                    "  --forces M         spring forces: vertex, colored, atomic or auto (default)\n"
+                    "  --substeps N       simulation steps per frame (default 10)\n"
+                    "  --readback-latency N  frames drawn positions may lag the simulation (default 1)\n"
+                    << DeviceSelection::usage;
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (native && collisions) {
+        std::cerr << "--collisions needs the opencl backend, native objects pass through each other" << std::endl;
+    }
+
+    // GPGPU_HF_TRACE=<file.json> writes a timeline of device commands and host spans;
+    // the profiler has to exist before the queue is created
+    Profiler profiler(getenv("GPGPU_HF_TRACE"));
+
+    // the native backend alone needs no OpenCL device at all
+    std::unique_ptr<CLWrapper> cl;
+    if (!native) {
+        cl.reset(new CLWrapper(selection));
+    }
+
+    MeshLoader meshLoader(VolumeMesh::springStrength);
+    loader = &meshLoader;
+
     SDL_Init(SDL_INIT_VIDEO);
 
     SDL_Window *window;
@@ -111,6 +256,8 @@ int main() {
     glEnable(GL_DEPTH_TEST);
     glClearDepth(1);
 
+    Renderer glRenderer(SDL_GL_GetProcAddress);
+
 
     bool quit = false;
     bool paused = false;
@@ -121,6 +268,10 @@ int main() {
 
         float dt = 0.01;
 
+        for (auto &mesh : loader->finished()) {
+            addVolume(std::move(mesh));
+        }
+
         SDL_Event event;
         while (SDL_PollEvent(&event)) {
             switch (event.type) {
@@ -154,6 +305,23 @@ int main() {
                         case SDL_SCANCODE_K:
                             deflateAll(dt);
                             break;
+                        case SDL_SCANCODE_F:
+                            fused = !fused;
+                            for (const auto &o : objects) {
+                                o->setFused(fused);
+                            }
+                            std::cout << (fused ? "FUSED STEP" : "SEPARATE KERNELS") << std::endl;
+                            break;
+                        case SDL_SCANCODE_N:
+                            integrator = (Integrator) (((int) integrator + 1) % integratorCount);
+                            for (const auto &o : objects) {
+                                o->setIntegrator(integrator);
+                            }
+                            std::cout << "INTEGRATOR: " << integratorName(integrator) << std::endl;
+                            break;
+                        case SDL_SCANCODE_BACKSPACE:
+                            removeLast();
+                            break;
                         case SDL_SCANCODE_X:
                             spheres.push_back(new Sphere);
                             break;
@@ -208,12 +376,20 @@ int main() {
 
         Uint32 ticks2 = SDL_GetTicks();
 
+        if (Profiler::instance) {
+            Profiler::instance->collect();
+        }
+
         //std::cout << "frametime: " << (ticks2 - ticks1) << "ms" << std::endl;
         //SDL_Delay(10);
     }
 
     clear();
 
+    if (Profiler::instance) {
+        Profiler::instance->write();
+    }
+
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
@@ -0,0 +1,118 @@
+//
+// OBJ parse throughput: the std::stringstream reference parser against the
+// memory mapped fast path, single and multi-threaded.
+//
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ObjLoader.hpp"
+#include "MappedFile.hpp"
+
+template<typename T>
+static bool sameData(const std::vector<T> &a, const std::vector<T> &b) {
+    return a.size() == b.size() && (a.empty() || !memcmp(a.data(), b.data(), a.size() * sizeof(T)));
+}
+
+static bool sameResult(const ObjLoader &a, const ObjLoader &b) {
+    return sameData(a.points, b.points) && sameData(a.normals, b.normals) &&
+           sameData(a.edges, b.edges) && sameData(a.faces, b.faces);
+}
+
+// runs parse until at least minSeconds passed, returns MB/s
+template<typename Parse>
+static double throughput(size_t bytes, double minSeconds, Parse parse) {
+    typedef std::chrono::steady_clock clock;
+
+    int runs = 0;
+    auto start = clock::now();
+    double elapsed = 0;
+    do {
+        parse();
+        ++runs;
+        elapsed = std::chrono::duration<double>(clock::now() - start).count();
+    } while (elapsed < minSeconds);
+
+    return bytes * (double) runs / elapsed / 1e6;
+}
+
+int main(int argc, char **argv) {
+    double minSeconds = 1.0;
+    std::vector<std::string> files;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--seconds") && i + 1 < argc) {
+            minSeconds = atof(argv[++i]);
+        } else if (argv[i][0] == '-') {
+            files.clear();
+            break;
+        } else {
+            files.push_back(argv[i]);
+        }
+    }
+
+    if (files.empty()) {
+        std::cerr << "usage: " << argv[0] << " [--seconds S] objects/<name>.obj ...\n";
+        return EXIT_FAILURE;
+    }
+
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::cout << std::fixed << std::setprecision(1);
+
+    for (const auto &file : files) {
+        size_t bytes;
+        {
+            MappedFile mapped(file);
+            if (!mapped.valid()) {
+                std::cerr << "cannot open " << file << std::endl;
+                return EXIT_FAILURE;
+            }
+            bytes = mapped.size();
+        }
+
+        ObjLoader reference;
+        std::ifstream in(file);
+        reference.parse_stream(in);
+
+        ObjLoader single, multi;
+        single.parse_file(file, 1);
+        multi.parse_file(file, threads);
+
+        bool same = sameResult(reference, single) && sameResult(reference, multi);
+
+        double streamRate = throughput(bytes, minSeconds, [&file]() {
+            ObjLoader o;
+            std::ifstream f(file);
+            o.parse_stream(f);
+        });
+        double singleRate = throughput(bytes, minSeconds, [&file]() {
+            ObjLoader o;
+            o.parse_file(file, 1);
+        });
+        double multiRate = throughput(bytes, minSeconds, [&file, threads]() {
+            ObjLoader o;
+            o.parse_file(file, threads);
+        });
+
+        std::cout << file << " (" << bytes / 1024 << " KiB, " << reference.points.size() << " points)"
+                << (same ? "" : " OUTPUT DIFFERS FROM STREAM PARSER") << "\n"
+                << "  stream:                " << streamRate << " MB/s\n"
+                << "  mapped:                " << singleRate << " MB/s\n"
+                << "  mapped, threads=" << std::setw(3) << std::left << threads << std::right << ": "
+                << multiRate << " MB/s" << std::endl;
+
+        if (!same) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}